@@ -0,0 +1,293 @@
+// Header include guard
+#ifndef ASSOCIATE_H	// if associate.h has not been included, include it, otherwise do not
+#define ASSOCIATE_H	// see end of file for corresponding #endif
+
+// General includes
+#include <iostream>		// cout
+#include <vector>		// vector
+#include <math.h>		// sqrt, fabs
+
+// OpenCV includes
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "common.hpp"	// Car, Config
+#include "shmo.hpp"		// Candidate, hue_cv
+
+// Namespaces
+using namespace std;
+using namespace cv;
+
+// Association definitions:
+#define ASSOC_MAX_CANDIDATES	(MAX_CANDIDATES*MAX_CARS)	// candidates associated per frame (MAX_CANDIDATES per car)
+#define ASSOC_HUE_SAMPLES		64		// source pixels sampled (at most) for a candidate's hue
+#define ASSOC_W_HUE				1.0f	// weight of the hue error (mean hue offset / delta)
+#define ASSOC_W_AREA			1.0f	// weight of the area error (relative to the car's last area)
+#define ASSOC_W_DISTANCE		1.0f	// weight of the distance from the prediction (relative to assoc_gate, see associate)
+#define ASSOC_MISS				100.0f	// cost of leaving a car without a candidate (above any candidate inside the gate)
+#define ASSOC_INFEASIBLE		1e6f	// cost of a pairing that is not allowed
+#define ASSOC_OVERLAP			0.5f	// share of the smaller bounding box two cars' candidates must overlap to be one blob
+#define ASSOC_WARN_INTERVAL		10		// shortest time (s) between association warnings
+
+
+float candidate_hue(Mat src, const vector<uchar> &lut, const Candidate &c, int car_bit, int hue)
+// Mean offset (OpenCV hue units, signed) of a candidate's pixels from a car's hue
+// Only source pixels the lookup table gives the car's bit are sampled (not the dilation around them), on a grid of up
+// to ASSOC_HUE_SAMPLES points over the bounding box. Works on BGR and I420 frames (see do_classify).
+{
+	int shift = 8 - LUT_BITS;
+	bool i420 = src.type() == CV_8UC1;
+	int height = i420 ? src.rows*2/3 : src.rows;
+	const uchar *plane_u = src.data + (size_t)src.cols*height;
+	size_t plane_bytes = (size_t)(src.cols/2)*(height/2);
+	int grid = max((int)sqrt(c.box.area()/(float)ASSOC_HUE_SAMPLES), 1);
+
+	float sum = 0;
+	int n = 0;
+	for (int y = c.box.y + grid/2; y < c.box.y + c.box.height; y += grid) {
+		for (int x = c.box.x + grid/2; x < c.box.x + c.box.width; x += grid) {
+			float r, g, b;
+			if (i420) {
+				if (src.ptr<uchar>(y)[x] < LUMA_MIN) continue;
+				int u = plane_u[(size_t)(y/2)*(src.cols/2) + x/2], v = plane_u[plane_bytes + (size_t)(y/2)*(src.cols/2) + x/2];
+				if (!(lut[(u << 8) | v] & car_bit)) continue;
+				r = 1.402f*(v - 128);		// colour differences, as in do_lut_uv
+				g = -0.344136f*(u - 128) - 0.714136f*(v - 128);
+				b = 1.772f*(u - 128);
+			} else {
+				const uchar *px = src.ptr<uchar>(y) + 3*x;
+				if (!(lut[((px[0] >> shift) << (2*LUT_BITS)) | ((px[1] >> shift) << LUT_BITS) | (px[2] >> shift)] & car_bit)) continue;
+				b = px[0];
+				g = px[1];
+				r = px[2];
+			}
+			float offset = hue_cv(r, g, b) - hue;
+			if (offset >= 90) offset -= 180;	// hue is circular
+			if (offset < -90) offset += 180;
+			sum += offset;
+			n++;
+		}
+	}
+	return n > 0 ? sum/n : 0;
+}
+
+
+// Per-frame association of candidate blobs with cars
+// Every blob within a car's size range is collected (find_candidates) rather than taking the last one found. Each is
+// scored against its car on hue (how far its pixels sit from the car's hue, which separates cars with neighbouring hue
+// ranges), area (against the car's last measured area) and distance from the car's predicted position. Candidates of
+// different cars covering the same pixels (a blob inside both hue ranges) are one blob, which only one car may take.
+// The cars are then assigned the set of distinct blobs with the lowest total cost (Hungarian method on a cars x blobs
+// matrix, with one "missing" column per car), so a distractor or a neighbouring car never wins over a better match.
+// Tracked cars only accept candidates within assoc_gate of their prediction (widened by assoc_gate for each frame
+// coasted). Without a gate the distance still counts, relative to the search window's half size (or to the car's side
+// if the full frame is searched). Frames that needed a choice are counted rather than reported each time (see warn).
+// Buffers are sized for ASSOC_MAX_CANDIDATES candidates when opened, so associating allocates nothing.
+struct Association {
+	vector<Candidate> candidates;	// this frame's candidates (find_candidates appends to this)
+	vector<int> blob;				// blob (index into blob_box) of each candidate
+	vector<Rect> blob_box;			// bounding box of each distinct blob
+	vector<int> blob_cars;			// cars with a candidate in each blob (bit i for cars_all[i])
+	vector<float> cost;				// cost of giving each blob to each car ([car][blob], blobs then one miss per car)
+	vector<int> choice;				// column assigned to each car (a blob, or n_blobs and above for none)
+	vector<double> u, v, min_slack;	// Hungarian method potentials and scratch (1-based)
+	vector<int> match, way;
+	vector<char> used;
+
+	// Counters (totals, and the totals when last reported)
+	long n_frames;					// frames associated
+	long n_ambiguous;				// cars given a choice of candidates (the old "more than one object" warning)
+	long n_shared;					// blobs wanted by more than one car
+	long n_gated;					// candidates outside their car's gate
+	long n_overflow;				// candidates left out over MAX_CANDIDATES of a car (counted by add_candidate)
+	long reported[4];
+	double time_reported;			// time of the last warning (ticks), 0 before the first
+
+	Association() : n_frames(0), n_ambiguous(0), n_shared(0), n_gated(0), n_overflow(0), time_reported(0) {
+		for (int i = 0; i < 4; i++) reported[i] = 0;
+	}
+
+	void open_association(int n_cars)
+	// Size the buffers for n_cars cars and ASSOC_MAX_CANDIDATES candidates
+	{
+		candidates.reserve(MAX_CANDIDATES*n_cars);	// find_candidates adds at most MAX_CANDIDATES per car
+		blob.resize(ASSOC_MAX_CANDIDATES);
+		blob_box.resize(ASSOC_MAX_CANDIDATES);
+		blob_cars.resize(ASSOC_MAX_CANDIDATES);
+		int columns = ASSOC_MAX_CANDIDATES + n_cars;
+		cost.resize(n_cars*columns);
+		choice.resize(n_cars);
+		u.resize(n_cars + 1);
+		v.resize(columns + 1);
+		min_slack.resize(columns + 1);
+		match.resize(columns + 1);
+		way.resize(columns + 1);
+		used.resize(columns + 1);
+		return;
+	}
+
+	void associate(vector<Car> &cars_all, const Config &config, Mat src, const vector<uchar> &lut, int cars = -1)
+	// Choose each car's measurement from this frame's candidates and store it (see set_measurement), then clear them
+	// cars		cars to associate (bit i for cars_all[i]), the others keep their measurements
+	// Positions and boxes of the candidates and the cars' predictions are in src pixels
+	{
+		int n_cars = cars_all.size();
+		if (candidates.size() > ASSOC_MAX_CANDIDATES) {		// (only if a car was searched more than once)
+			n_overflow += candidates.size() - ASSOC_MAX_CANDIDATES;
+			candidates.resize(ASSOC_MAX_CANDIDATES);
+		}
+
+		// Group candidates of different cars covering the same pixels into blobs
+		int n_blobs = 0;
+		for (int i = 0; i < candidates.size(); i++) {
+			const Candidate &c = candidates[i];
+			int b = 0;
+			for (; b < n_blobs; b++) {
+				if (blob_cars[b] & (1 << c.car)) continue;
+				float overlap = (c.box & blob_box[b]).area();
+				if (overlap > ASSOC_OVERLAP*min(c.box.area(), blob_box[b].area())) break;
+			}
+			if (b == n_blobs) {
+				blob_box[n_blobs] = c.box;
+				blob_cars[n_blobs] = 0;
+				n_blobs++;
+			}
+			blob[i] = b;
+			blob_cars[b] |= 1 << c.car;
+		}
+
+		// Cost of each car taking each blob (infeasible unless the car has a candidate there), then of each car missing
+		int columns = n_blobs + n_cars;
+		for (int k = 0; k < n_cars*columns; k++) cost[k] = ASSOC_INFEASIBLE;
+		for (int jj = 0; jj < n_cars; jj++) cost[jj*columns + n_blobs + jj] = ASSOC_MISS;
+		for (int i = 0; i < candidates.size(); i++) {
+			Candidate &c = candidates[i];
+			const Car &car = cars_all[c.car];
+			if (!(cars & (1 << c.car))) continue;
+
+			float distance = 0;
+			if (car.n_tracked > 0) {
+				float dx = c.x - car.position_pred[0], dy = c.y - car.position_pred[1];
+				if (config.assoc_gate > 0) {
+					distance = config.scale*sqrt(dx*dx + dy*dy)/config.assoc_gate;
+					if (distance > 1 + car.n_coast) {
+						n_gated++;		// (gated before its hue is sampled, so distant distractors cost little)
+						continue;
+					}
+				} else {
+					float reach = config.roi_size > 0 ? config.roi_size/2.0f + config.roi_margin
+						: sqrt((float)max(car.size_max, 1));	// (pixels)
+					distance = sqrt(dx*dx + dy*dy)/reach;
+				}
+			}
+			float hue = fabs(candidate_hue(src, lut, c, 1 << c.car, car.hue))/max(car.delta, 1);
+			float area_ref = car.n_tracked > 0 && car.area_old > 0 ? car.area_old : (car.size_min + car.size_max)/2.0f;
+			float area = fabs(c.area - area_ref)/area_ref;
+			c.cost = ASSOC_W_HUE*hue + ASSOC_W_AREA*area + ASSOC_W_DISTANCE*distance;
+			cost[c.car*columns + blob[i]] = c.cost;		// a blob holds at most one candidate of each car
+		}
+
+		// Count the choices that had to be made
+		for (int jj = 0; jj < n_cars; jj++) {
+			int n_feasible = 0;
+			for (int b = 0; b < n_blobs; b++) n_feasible += cost[jj*columns + b] < ASSOC_INFEASIBLE;
+			if (n_feasible > 1) n_ambiguous++;
+		}
+		for (int b = 0; b < n_blobs; b++) {
+			int n_wanting = 0;
+			for (int jj = 0; jj < n_cars; jj++) n_wanting += cost[jj*columns + b] < ASSOC_INFEASIBLE;
+			if (n_wanting > 1) n_shared++;
+		}
+
+		// Assign and store the measurements
+		assign(n_cars, columns);
+		for (int jj = 0; jj < n_cars; jj++) {
+			if (!(cars & (1 << jj))) continue;
+			const Candidate *found = NULL;
+			if (choice[jj] < n_blobs) {
+				for (int i = 0; i < candidates.size() && found == NULL; i++) {
+					if (candidates[i].car == jj && blob[i] == choice[jj]) found = &candidates[i];
+				}
+			}
+			set_measurement(cars_all[jj], found);
+		}
+		candidates.clear();
+		n_frames++;
+		return;
+	}
+
+	void assign(int n_rows, int columns)
+	// Minimum cost assignment of the n_rows cars to distinct columns of cost (n_rows <= columns), into choice
+	// Hungarian method (shortest augmenting paths with potentials), O(n_rows^2 columns)
+	{
+		for (int j = 0; j <= columns; j++) {
+			v[j] = 0;
+			match[j] = 0;
+		}
+		for (int i = 0; i <= n_rows; i++) u[i] = 0;
+		for (int i = 1; i <= n_rows; i++) {
+			// Add car i, growing alternating paths from it until a free column is reached
+			match[0] = i;
+			int j0 = 0;
+			for (int j = 0; j <= columns; j++) {
+				min_slack[j] = 1e18;
+				used[j] = 0;
+			}
+			do {
+				used[j0] = 1;
+				int i0 = match[j0], j1 = 0;
+				double delta = 1e18;
+				for (int j = 1; j <= columns; j++) {
+					if (used[j]) continue;
+					double slack = cost[(i0 - 1)*columns + j - 1] - u[i0] - v[j];
+					if (slack < min_slack[j]) {
+						min_slack[j] = slack;
+						way[j] = j0;
+					}
+					if (min_slack[j] < delta) {
+						delta = min_slack[j];
+						j1 = j;
+					}
+				}
+				for (int j = 0; j <= columns; j++) {
+					if (used[j]) {
+						u[match[j]] += delta;
+						v[j] -= delta;
+					} else {
+						min_slack[j] -= delta;
+					}
+				}
+				j0 = j1;
+			} while (match[j0] != 0);
+
+			// Flip the path
+			do {
+				int j1 = way[j0];
+				match[j0] = match[j1];
+				j0 = j1;
+			} while (j0 != 0);
+		}
+		for (int j = 1; j <= columns; j++) {
+			if (match[j] != 0) choice[match[j] - 1] = j - 1;
+		}
+		return;
+	}
+
+	void warn(int camera, double time_now)
+	// Report the choices made since the last report, at most every ASSOC_WARN_INTERVAL seconds (nothing if none were)
+	{
+		if (time_reported != 0 && (time_now - time_reported)/cv::getTickFrequency() < ASSOC_WARN_INTERVAL) return;
+		long counts[4] = {n_ambiguous, n_shared, n_gated, n_overflow};
+		if (counts[0] == reported[0] && counts[1] == reported[1] && counts[2] == reported[2] && counts[3] == reported[3]) return;
+		cout << "WARNING: camera " << camera << ": " << counts[0] - reported[0] << " cars with several candidates, "
+			<< counts[1] - reported[1] << " blobs matching several cars, " << counts[2] - reported[2] << " candidates outside the gate";
+		if (counts[3] > reported[3]) cout << ", " << counts[3] - reported[3] << " candidates over the limit";
+		cout << " since the last report" << endl;
+		for (int i = 0; i < 4; i++) reported[i] = counts[i];
+		time_reported = time_now;
+		return;
+	}
+};
+
+
+
+#endif
@@ -0,0 +1,826 @@
+// Benchmarks for the detection kernels, the tracker's accuracy and the steady-state frame path
+// Usage: ./bench [source] [iterations] [results (default bench.json)]
+// source is a recording (see frame_source.hpp) whose first frame is used for the kernel benchmarks, or "synthetic"
+// (default) for a generated frame containing one patch of each car's hue. Cars and crop are read from config.txt.
+// The end-to-end run always uses a generated sequence (see synthetic.hpp) so detections can be compared with ground
+// truth. Also checks that the steady-state frame path (detection, merging, tracking, logging and publishing) makes
+// no heap allocations once warmed up. The exit status is non-zero if a check fails. Every figure is also written to
+// the results file as one JSON object, so runs can be compared across commits.
+
+// General includes
+#include <iostream>		// cout
+#include <cstdlib>		// atoi, malloc
+#include <new>			// bad_alloc
+#include <atomic>		// atomic
+#include <thread>		// thread
+#include <unistd.h>		// getpid
+
+// Algorithm-specific includes
+#include "shmo.hpp"			// specific to this algorithm
+#include "common.hpp"		// common definitions
+#include "frame_source.hpp"	// recordings
+#include "camera_worker.hpp"	// per-camera detection
+#include "static_mask.hpp"	// static distractor exclusion
+#include "associate.hpp"	// candidate association
+#include "publisher.hpp"	// telemetry formatting and shared-memory state
+#include "synthetic.hpp"	// generated scenes with ground truth
+
+// OpenCV includes
+#include "opencv2/imgproc/imgproc.hpp"
+
+// Namespaces
+using namespace std;
+using namespace cv;
+
+// Benchmark definitions:
+#define BENCH_WARMUP		20		// frames run before allocations are counted (buffers grow to their working sizes)
+#define BENCH_REPEAT		1000	// calls per iteration of the microbenchmarks of fast functions (do_track)
+#define BENCH_NOISE			20		// pixel noise of the end-to-end sequence
+#define BENCH_LIGHTING		0.3f	// lighting change of the end-to-end sequence
+#define BENCH_SETTLE		10		// frames before velocity errors are counted (the tracking filter starts from rest)
+#define BENCH_STATIC		5		// frames of the empty arena the static mask is calibrated from
+#define BENCH_AREA_TOLERANCE	0.02f	// largest relative difference between blob and contour areas
+#define BENCH_DISTRACTORS	16		// distractors added to the frame the association is checked on (over MAX_CANDIDATES)
+#define BENCH_SHM_MS		500		// time a reader copies snapshots of the shared-memory block while it is written
+
+
+// Counting global allocator: every operator new (and new[], which calls it) in any thread is counted
+atomic<long> n_allocations(0);
+
+void *operator new(size_t n)
+{
+	n_allocations++;
+	void *p = malloc(n > 0 ? n : 1);
+	if (p == NULL) throw bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+
+// Frame source replaying two frames alternately (the second shifted, so every car moves), copied into the frame
+// buffer as a camera would deliver them
+struct SyntheticSource : FrameSource {
+	Mat images[2];
+	long n_read;
+
+	SyntheticSource(Mat a, Mat b) : n_read(0) {
+		images[0] = a;
+		images[1] = b;
+		size = a.size();
+		type = a.type();
+	}
+
+	bool open_source(void) { return true; }
+
+	bool read(Frame &frame)
+	{
+		images[n_read % 2].copyTo(frame.image);
+		frame.time = cv::getTickCount();
+		n_read++;
+		return true;
+	}
+};
+
+
+// Figures written to the results file
+struct Metrics {
+	vector<string> names;
+	vector<double> values;
+
+	void add(const string &name, double value)
+	// Record a figure (names are JSON keys)
+	{
+		names.push_back(name);
+		values.push_back(value);
+		return;
+	}
+
+	bool save(const char *filename) const
+	// Write every figure as one JSON object
+	{
+		FILE *f = fopen(filename, "w");
+		if (f == NULL) return false;
+		fprintf(f, "{");
+		for (int i = 0; i < names.size(); i++) {
+			fprintf(f, "%s\n  \"%s\": %.6g", i > 0 ? "," : "", names[i].c_str(), values[i]);
+		}
+		fprintf(f, "\n}\n");
+		fclose(f);
+		return true;
+	}
+};
+
+
+void find_car_contours(Mat labels, int car_bit, Car &car, Point offset)
+// Previous find_car (findContours, contourArea and moments), kept as the reference for the blob extractor
+{
+	Mat mask_use = Mat::zeros(labels.rows, labels.cols, CV_8UC1);
+	bitwise_and(labels, Scalar(car_bit), mask_use);
+	vector<vector<Point> > contours;
+	findContours(mask_use, contours, RETR_LIST, CHAIN_APPROX_SIMPLE, offset);
+
+	int contour_idx = -1;
+	float contour_area = -1;
+	for (int i = 0; i < contours.size(); i++) {
+		float area = contourArea(contours[i]);
+		if (area > car.size_min && area < car.size_max) {
+			contour_idx = i;
+			contour_area = area;
+		}
+	}
+	if (contour_idx < 0) {
+		car.position_new[0] = 0;
+		car.position_new[1] = 0;
+		car.area_new = -1;
+		return;
+	}
+	Moments mu = moments(contours[contour_idx], true);
+	car.position_new[0] = mu.m10 / mu.m00;
+	car.position_new[1] = mu.m01 / mu.m00;
+	car.area_new = contour_area;
+	return;
+}
+
+
+Scalar car_colour(const Car &car)
+// Saturated BGR colour at the middle of a car's hue range
+{
+	Mat hsv(1, 1, CV_8UC3, Scalar(car.hue, 220, 200)), bgr;
+	cvtColor(hsv, bgr, COLOR_HSV2BGR);
+	const Vec3b &px = bgr.at<Vec3b>(0, 0);
+	return Scalar(px[0], px[1], px[2]);
+}
+
+
+int count_candidates(Mat labels, const Car &car, BlobFinder &finder)
+// Number of blobs of a car's bit within its size range (find_car uses the last of them)
+{
+	finder.find(labels, 1, Point(0, 0));
+	int n = 0;
+	for (int i = 0; i < finder.blobs.size(); i++) {
+		if (finder.blobs[i].area() > car.size_min && finder.blobs[i].area() < car.size_max) n++;
+	}
+	return n;
+}
+
+
+void shm_write_frames(ShmWriter *writer, vector<Car> *cars, atomic<bool> *stop, long *n_written)
+// Write states 1, 2, ... to the shared-memory block as fast as possible until stop is set, every value of state n
+// derived from n (car i holds n % 2^20 + i, small enough for floats to hold exactly, see shm_consistent)
+{
+	double ticks = cv::getTickFrequency();
+	long n = 0;
+	while (!stop->load(memory_order_relaxed)) {
+		n++;
+		for (int i = 0; i < cars->size(); i++) {
+			Car &car = (*cars)[i];
+			long v = n % (1 << 20) + i;
+			car.area_new = v;
+			car.n_coast = v;
+			car.position_new[0] = v;
+			car.position_new[1] = -v;
+			car.velocity_new[0] = v + 0.5f;
+			car.velocity_new[1] = v - 0.5f;
+			car.orientation_new = v;
+		}
+		writer->write_state(*cars, n, n*ticks);
+	}
+	*n_written = n;
+	return;
+}
+
+
+bool shm_consistent(const ShmState &state)
+// Check every value of a snapshot comes from the same state written by shm_write_frames
+{
+	long n = state.frame;
+	if (fabs(state.time - n) > 1e-6*n) return false;
+	for (int i = 0; i < state.n_cars; i++) {
+		const ShmCar &car = state.cars[i];
+		long v = n % (1 << 20) + i;
+		if (car.found != 1 || car.n_coast != v || car.area != v || car.position[0] != v || car.position[1] != -v
+				|| car.velocity[0] != v + 0.5f || car.velocity[1] != v - 0.5f || car.orientation != v) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+double time_ms(double tick_start, int iterations)
+// Average time per iteration in milliseconds since tick_start
+{
+	return (cv::getTickCount() - tick_start)/cv::getTickFrequency()*1000/iterations;
+}
+
+
+int main(int argc, char **argv)
+{
+	string source_name = argc > 1 ? argv[1] : "synthetic";
+	int iterations = argc > 2 ? atoi(argv[2]) : 100;
+	const char *results_name = argc > 3 ? argv[3] : "bench.json";
+	Metrics metrics;
+
+	// Configure cars from config file
+	Config config;
+	vector<Car> cars_all;
+	do_config(cars_all, config);
+	vector<uchar> lut;
+	do_lut(cars_all, lut);
+
+	// Test frame
+	Mat src;
+	if (source_name == "synthetic") {
+		SyntheticScene still;
+		still.open_scene(cars_all, Size(IMG_WIDTH, IMG_HEIGHT), config.crop, 0, 0);
+		still.render(0, src);
+	} else {
+		FrameSource *source = make_source(source_name, config);
+		Frame frame;
+		if (source == NULL || !source->open_source() || !source->read(frame)) {
+			cout << "Error: could not read a frame from " << source_name << endl;
+			return 1;
+		}
+		if (source->i420) {
+			cvtColor(frame.image, src, COLOR_YUV2BGR_I420);
+		} else {
+			src = frame.image.clone();
+		}
+		source->release();
+		delete source;
+	}
+	Rect full(0, 0, src.cols, src.rows);
+	cout << "Frame: " << src.cols << "x" << src.rows << ", " << cars_all.size() << " cars, " << iterations << " iterations" << endl;
+	metrics.add("frame_width", src.cols);
+	metrics.add("frame_height", src.rows);
+	metrics.add("cars", cars_all.size());
+	metrics.add("iterations", iterations);
+
+	// Reference OpenCV path: HSV conversion then inRange, crop and dilate for each car
+	Mat src_hsv;
+	vector<Mat> masks_all(cars_all.size());
+	for (int i = 0; i < cars_all.size(); i++) masks_all[i] = Mat::zeros(src.rows, src.cols, CV_8UC1);
+	double tick = cv::getTickCount();
+	for (int it = 0; it < iterations; it++) {
+		cvtColor(src, src_hsv, COLOR_BGR2HSV);
+		for (int i = 0; i < cars_all.size(); i++) {
+			do_mask(src_hsv, masks_all[i], cars_all[i].hue, cars_all[i].delta, config.crop, cars_all[i].name);
+		}
+	}
+	double time_mask = time_ms(tick, iterations);
+	printf("cvtColor + do_mask:      %8.3f ms/frame\n", time_mask);
+	metrics.add("do_mask_ms", time_mask);
+
+	// Fused kernel
+	Mat labels = Mat::zeros(src.rows, src.cols, CV_8UC1);
+	Mat rows = Mat::zeros(CLASSIFY_ROWS, src.cols + 2, CV_8UC1);
+	tick = cv::getTickCount();
+	for (int it = 0; it < iterations; it++) {
+		do_classify(src, labels, rows, lut, config.crop, full);
+	}
+	double time_classify = time_ms(tick, iterations);
+	printf("do_classify:             %8.3f ms/frame\n", time_classify);
+	metrics.add("do_classify_ms", time_classify);
+
+	// Equivalence: the fused kernel must match a lookup followed by OpenCV's crop and dilation bit for bit
+	int shift = 8 - LUT_BITS;
+	Mat element = getStructuringElement(MORPH_RECT, Size(3, 3), Point(-1, -1));
+	long n_mismatch = 0, n_quantised = 0;
+	for (int i = 0; i < cars_all.size(); i++) {
+		Mat mask = Mat::zeros(src.rows, src.cols, CV_8UC1);
+		for (int y = 0; y < src.rows; y++) {
+			const uchar *px = src.ptr<uchar>(y);
+			for (int x = 0; x < src.cols; x++) {
+				uchar label = lut[((px[3*x] >> shift) << (2*LUT_BITS)) | ((px[3*x + 1] >> shift) << LUT_BITS) | (px[3*x + 2] >> shift)];
+				mask.at<uchar>(y, x) = (label & (1 << i)) ? 255 : 0;
+			}
+		}
+		Mat mask_crop = Mat::zeros(src.rows, src.cols, CV_8UC1);
+		rectangle(mask_crop, Point(config.crop, config.crop), Point(src.cols - config.crop, src.rows - config.crop), 255, CV_FILLED);
+		mask = mask & mask_crop;
+		dilate(mask, mask, element, Point(-1, -1), 1);
+
+		Mat fused = (labels & Scalar(1 << i)) != 0;
+		n_mismatch += countNonZero(fused != mask);
+		n_quantised += countNonZero(fused != masks_all[i]);
+	}
+	printf("mismatches vs lookup + OpenCV crop/dilate: %ld pixels\n", n_mismatch);
+	metrics.add("classify_mismatches", n_mismatch);
+	metrics.add("classify_quantised_pixels", n_quantised);
+	printf("differences vs HSV path (lookup quantisation): %ld pixels (%.3f%%)\n", n_quantised,
+		100.0*n_quantised/(src.rows*src.cols*max((int)cars_all.size(), 1)));
+
+	// Blob extraction against the previous contour-based find_car on the same labels
+	BlobFinder finder;
+	vector<Car> cars_contours = cars_all, cars_blobs = cars_all;
+	tick = cv::getTickCount();
+	for (int it = 0; it < iterations; it++) {
+		for (int i = 0; i < cars_all.size(); i++) find_car_contours(labels, 1 << i, cars_contours[i], Point(0, 0));
+	}
+	double time_contours = time_ms(tick, iterations);
+	printf("find_car (contours):     %8.3f ms/frame\n", time_contours);
+	metrics.add("find_car_contours_ms", time_contours);
+	tick = cv::getTickCount();
+	for (int it = 0; it < iterations; it++) {
+		for (int i = 0; i < cars_all.size(); i++) find_car(labels, 1 << i, cars_blobs[i], Point(0, 0), finder);
+	}
+	double time_blobs = time_ms(tick, iterations);
+	printf("find_car (blobs):        %8.3f ms/frame\n", time_blobs);
+	metrics.add("find_car_ms", time_blobs);
+	// Areas of solid blobs are identical (see Blob::area), those with holes or spurs differ slightly; centroids are of the
+	// pixels rather than of the contour polygon
+	long n_blob_mismatch = 0;
+	for (int i = 0; i < cars_all.size(); i++) {
+		const Car &a = cars_contours[i], &b = cars_blobs[i];
+		printf("  %-8s contours: area %7.1f at (%6.1f, %6.1f)   blobs: area %7.1f at (%6.1f, %6.1f)\n", cars_all[i].name.c_str(),
+			a.area_new, a.position_new[0], a.position_new[1], b.area_new, b.position_new[0], b.position_new[1]);
+		if ((a.area_new < 0) != (b.area_new < 0)) {
+			n_blob_mismatch++;
+		} else if (a.area_new >= 0 && (fabs(b.area_new - a.area_new) > BENCH_AREA_TOLERANCE*a.area_new
+				|| sqrt(pow(a.position_new[0] - b.position_new[0], 2) + pow(a.position_new[1] - b.position_new[1], 2)) > 1)) {
+			n_blob_mismatch++;
+		}
+	}
+	printf("blob vs contour mismatches: %ld\n", n_blob_mismatch);
+	metrics.add("blob_mismatches", n_blob_mismatch);
+
+	// Tracking filter and message formatting for every car (do_track is timed over BENCH_REPEAT frames per iteration)
+	vector<Car> cars_tracked = cars_blobs;
+	double time_frame = cv::getTickFrequency()/SCENE_FPS;
+	tick = cv::getTickCount();
+	for (int it = 0; it < iterations*BENCH_REPEAT; it++) {
+		for (int i = 0; i < cars_all.size(); i++) {
+			cars_tracked[i].position_new[0] = cars_blobs[i].position_new[0] + it % 7;
+			cars_tracked[i].position_new[1] = cars_blobs[i].position_new[1];
+			cars_tracked[i].area_new = cars_blobs[i].area_new;
+			do_track(cars_tracked[i], config, it*time_frame);
+		}
+	}
+	double time_track = time_ms(tick, iterations*BENCH_REPEAT);
+	printf("do_track:                %8.5f ms/frame\n", time_track);
+	metrics.add("do_track_ms", time_track);
+	Publisher formatter;
+	formatter.open_publisher(cars_all, config, 4);
+	size_t n_bytes = 0;
+	tick = cv::getTickCount();
+	for (int it = 0; it < iterations*BENCH_REPEAT/10; it++) {
+		n_bytes = formatter.format_json(cars_tracked, it, 0, 0, 0);
+	}
+	double time_json = time_ms(tick, iterations*BENCH_REPEAT/10);
+	printf("format_json:             %8.5f ms/frame (%i bytes)\n", time_json, (int)n_bytes);
+	metrics.add("format_json_ms", time_json);
+
+	// Multi-resolution detection against the full resolution path (classify the whole frame, then find every car; the
+	// decimated path collects candidates and associates them, as the tracker does)
+	for (int i = 0; i < cars_blobs.size(); i++) cars_blobs[i].roi = full;
+	tick = cv::getTickCount();
+	for (int it = 0; it < iterations; it++) {
+		do_classify(src, labels, rows, lut, config.crop, full);
+		for (int i = 0; i < cars_all.size(); i++) find_car(labels, 1 << i, cars_blobs[i], Point(0, 0), finder);
+	}
+	double time_full = time_ms(tick, iterations);
+	printf("full resolution detection:  %8.3f ms/frame\n", time_full);
+	metrics.add("detect_full_ms", time_full);
+	BlobFinder finder_fine;
+	Association association;
+	association.open_association(cars_all.size());
+	for (int step = 2; step <= 4; step *= 2) {
+		Mat labels_small = Mat::zeros(src.rows/step, src.cols/step, CV_8UC1);
+		Mat labels_fine = Mat::zeros(src.rows, src.cols, CV_8UC1);
+		vector<Car> cars_decimated = cars_blobs;
+		tick = cv::getTickCount();
+		for (int it = 0; it < iterations; it++) {
+			do_classify(src, labels_small, rows, lut, config.crop, Rect(0, 0, labels_small.cols, labels_small.rows), step);
+			for (int i = 0; i < cars_all.size(); i++) {
+				find_candidates_decimated(src, labels_fine, labels_small, rows, lut, config.crop, step, 1 << i, i, cars_decimated[i], finder,
+					finder_fine, association.candidates, association.n_overflow);
+			}
+			association.associate(cars_decimated, config, src, lut);
+		}
+		double time_decimated = time_ms(tick, iterations);
+		printf("decimation %i detection:    %8.3f ms/frame (%.2fx)\n", step, time_decimated, time_full/time_decimated);
+		metrics.add(step == 2 ? "detect_decimation2_ms" : "detect_decimation4_ms", time_decimated);
+		for (int i = 0; i < cars_all.size(); i++) {
+			const Car &a = cars_blobs[i], &b = cars_decimated[i];
+			if (a.area_new < 0 || b.area_new < 0) {
+				printf("  %-8s found at full resolution: %s, decimated: %s\n", cars_all[i].name.c_str(), a.area_new < 0 ? "no" : "yes",
+					b.area_new < 0 ? "no" : "yes");
+				continue;
+			}
+			printf("  %-8s centroid error %6.3f px, area %7.1f vs %7.1f\n", cars_all[i].name.c_str(),
+				sqrt(pow(a.position_new[0] - b.position_new[0], 2) + pow(a.position_new[1] - b.position_new[1], 2)), b.area_new, a.area_new);
+		}
+	}
+
+	// I420 path (chroma lookup on the quarter-size planes) against the full resolution BGR path
+	Mat yuv;
+	cvtColor(src, yuv, COLOR_BGR2YUV_I420);
+	vector<uchar> lut_uv;
+	do_lut_uv(cars_all, lut_uv);
+	Mat labels_uv = Mat::zeros(src.rows/2, src.cols/2, CV_8UC1);
+	vector<Car> cars_uv = cars_blobs;
+	tick = cv::getTickCount();
+	for (int it = 0; it < iterations; it++) {
+		do_classify(yuv, labels_uv, rows, lut_uv, config.crop, Rect(0, 0, labels_uv.cols, labels_uv.rows), 2);
+		for (int i = 0; i < cars_all.size(); i++) find_car(labels_uv, 1 << i, cars_uv[i], Point(0, 0), finder, 2);
+	}
+	double time_uv = time_ms(tick, iterations);
+	printf("I420 detection:             %8.3f ms/frame (%.2fx)\n", time_uv, time_full/time_uv);
+	metrics.add("detect_i420_ms", time_uv);
+	for (int i = 0; i < cars_all.size(); i++) {
+		const Car &a = cars_blobs[i], &b = cars_uv[i];
+		if (a.area_new < 0 || b.area_new < 0) {
+			printf("  %-8s found from BGR: %s, from I420: %s\n", cars_all[i].name.c_str(), a.area_new < 0 ? "no" : "yes",
+				b.area_new < 0 ? "no" : "yes");
+			continue;
+		}
+		printf("  %-8s centroid error %6.3f px, area %7.1f vs %7.1f\n", cars_all[i].name.c_str(),
+			sqrt(pow(a.position_new[0] - b.position_new[0], 2) + pow(a.position_new[1] - b.position_new[1], 2)), b.area_new, a.area_new);
+	}
+
+	// Parallel detection (labelling and blob search in stripes) against the serial full resolution path: the labels and
+	// every blob must be identical. Random labels (about half the pixels set) give many components crossing the stripe
+	// boundaries.
+	Mat labels_random = Mat::zeros(src.rows, src.cols, CV_8UC1);
+	RNG rng(2);
+	for (int y = 0; y < src.rows; y++) {
+		for (int x = 0; x < src.cols; x++) labels_random.at<uchar>(y, x) = rng.uniform(0, 2);
+	}
+	long n_parallel_mismatch = 0;
+	for (int n_threads = 2; n_threads <= 4; n_threads *= 2) {
+		StripePool pool;
+		pool.open_pool(n_threads);
+		ClassifyStripes classifier;
+		classifier.open_stripes(src.cols, n_threads);
+		BlobFinder finder_parallel;
+		finder_parallel.use_pool(&pool);
+		Mat labels_parallel = Mat::zeros(src.rows, src.cols, CV_8UC1);
+		vector<Car> cars_parallel = cars_blobs;
+		tick = cv::getTickCount();
+		for (int it = 0; it < iterations; it++) {
+			classifier.classify(&pool, src, labels_parallel, lut, config.crop, full);
+			for (int i = 0; i < cars_all.size(); i++) find_car(labels_parallel, 1 << i, cars_parallel[i], Point(0, 0), finder_parallel);
+		}
+		double time_parallel = time_ms(tick, iterations);
+		printf("%i-thread detection:         %8.3f ms/frame (%.2fx)\n", n_threads, time_parallel, time_full/time_parallel);
+		metrics.add(n_threads == 2 ? "detect_threads2_ms" : "detect_threads4_ms", time_parallel);
+
+		do_classify(src, labels, rows, lut, config.crop, full);
+		n_parallel_mismatch += countNonZero(labels != labels_parallel);
+		for (int i = 0; i <= cars_all.size(); i++) {
+			Mat searched = i < cars_all.size() ? labels : labels_random;
+			int bit = i < cars_all.size() ? 1 << i : 1;
+			finder.find(searched, bit, Point(0, 0));
+			finder_parallel.find(searched, bit, Point(0, 0));
+			if (finder.blobs.size() != finder_parallel.blobs.size()) {
+				n_parallel_mismatch++;
+				continue;
+			}
+			for (int j = 0; j < finder.blobs.size(); j++) {
+				const Blob &a = finder.blobs[j], &b = finder_parallel.blobs[j];
+				if (a.pixels != b.pixels || a.boundary != b.boundary || a.box() != b.box() || a.sum_x != b.sum_x || a.sum_y != b.sum_y) {
+					n_parallel_mismatch++;
+				}
+			}
+		}
+		pool.close_pool();
+	}
+	printf("parallel mismatches vs serial (labels and blobs): %ld\n", n_parallel_mismatch);
+	metrics.add("parallel_mismatches", n_parallel_mismatch);
+
+	// End-to-end run on a generated sequence with ground truth (cars driving loops, pixel noise and lighting changes):
+	// a camera worker's detection, then the publishing stage's merging, tracking and formatting, frame by frame
+	SyntheticScene scene;
+	scene.open_scene(cars_all, Size(IMG_WIDTH, IMG_HEIGHT), config.crop, BENCH_NOISE, BENCH_LIGHTING);
+	vector<Mat> sequence(iterations);
+	for (int it = 0; it < iterations; it++) scene.render(double (it)/SCENE_FPS, sequence[it]);
+	{
+		CameraConfig camera;
+		camera.crop = config.crop;
+		camera.origin[0] = config.origin[0];
+		camera.origin[1] = config.origin[1];
+		camera.scale = config.scale;
+		CameraWorker worker;
+		worker.source = new SyntheticSource(sequence[0], sequence[0]);
+		if (!worker.open_worker(0, camera, config, cars_all)) return 1;
+		Result result;
+		result.cars_all = cars_all;
+		Result *results[1] = {&result};
+		vector<Car> cars_world = cars_all;
+		Publisher publisher;
+		publisher.open_publisher(cars_world, config, 4);
+		Histogram time_tracking, time_formatting;
+		long n_found = 0, n_measured = 0, n_velocity = 0;
+		double sum_position = 0, max_position = 0, sum_velocity = 0, max_velocity = 0;
+
+		double tick_start = cv::getTickCount();
+		for (int it = 0; it < iterations; it++) {
+			Frame frame;
+			frame.image = sequence[it];
+			frame.seq = it;
+			frame.time = tick_start + it*time_frame;	// the sequence's own clock, so velocities are in real units
+			frame.time_read = frame.time;
+			worker.detect(frame, result);
+			double tick_detected = cv::getTickCount();
+			merge_results(cars_world, results, 1, config.merge_distance, result.time);
+			for (int i = 0; i < cars_world.size(); i++) do_track(cars_world[i], config, result.time);
+			double tick_tracked = cv::getTickCount();
+			publisher.format_json(cars_world, it, 0, 0, 0);
+			time_tracking.record((tick_tracked - tick_detected)*1e9/cv::getTickFrequency());
+			time_formatting.record((cv::getTickCount() - tick_tracked)*1e9/cv::getTickFrequency());
+
+			// Errors against ground truth (world coordinates)
+			for (int i = 0; i < cars_all.size(); i++) {
+				SceneTruth truth = scene.truth(i, double (it)/SCENE_FPS);
+				float x = config.scale*(truth.x - config.origin[0]), y = config.scale*(truth.y - config.origin[1]);
+				const Car &measured = result.cars_all[i];
+				n_measured++;
+				if (measured.area_new > 0) {
+					double error = sqrt(pow(measured.position_new[0] - x, 2) + pow(measured.position_new[1] - y, 2));
+					sum_position += error;
+					max_position = max(max_position, error);
+					n_found++;
+				}
+				if (it >= BENCH_SETTLE && cars_world[i].n_tracked > 0) {
+					double error = sqrt(pow(cars_world[i].velocity_new[0] - config.scale*truth.v_x, 2)
+						+ pow(cars_world[i].velocity_new[1] - config.scale*truth.v_y, 2));
+					sum_velocity += error;
+					max_velocity = max(max_velocity, error);
+					n_velocity++;
+				}
+			}
+		}
+		double time_e2e = time_ms(tick_start, iterations);
+		worker.close_worker();
+
+		const Histogram &classify = worker.stats.stages[STAGE_CLASSIFY], &find = worker.stats.stages[STAGE_FIND];
+		printf("end-to-end (%i frames, %i noise, %.0f%% lighting): %8.3f ms/frame (%.1f fps)\n", iterations, BENCH_NOISE,
+			100*BENCH_LIGHTING, time_e2e, 1000/time_e2e);
+		printf("  p50 classify %.3f ms, find %.3f ms, merge and track %.4f ms, format %.4f ms\n", classify.percentile(50)/1e6,
+			find.percentile(50)/1e6, time_tracking.percentile(50)/1e6, time_formatting.percentile(50)/1e6);
+		printf("  detected %.1f%% of car-frames, centroid error %.2f mm mean, %.2f mm max\n", 100.0*n_found/max(n_measured, 1L),
+			sum_position/max(n_found, 1L), max_position);
+		printf("  velocity error (after %i frames) %.1f mm/s mean, %.1f mm/s max\n", BENCH_SETTLE, sum_velocity/max(n_velocity, 1L),
+			max_velocity);
+		metrics.add("e2e_ms", time_e2e);
+		metrics.add("e2e_fps", 1000/time_e2e);
+		metrics.add("e2e_classify_p50_ms", classify.percentile(50)/1e6);
+		metrics.add("e2e_find_p50_ms", find.percentile(50)/1e6);
+		metrics.add("e2e_track_p50_ms", time_tracking.percentile(50)/1e6);
+		metrics.add("e2e_format_p50_ms", time_formatting.percentile(50)/1e6);
+		metrics.add("e2e_detection_rate", double (n_found)/max(n_measured, 1L));
+		metrics.add("e2e_centroid_error_mean_mm", sum_position/max(n_found, 1L));
+		metrics.add("e2e_centroid_error_max_mm", max_position);
+		metrics.add("e2e_velocity_error_mean_mm_s", sum_velocity/max(n_velocity, 1L));
+		metrics.add("e2e_velocity_error_max_mm_s", max_velocity);
+	}
+
+	// Static scene exclusion: a fixed patch of the first car's colour (a distractor) in the generated arena is calibrated
+	// out from frames of the empty arena, after which only the car itself may be found; an obstacle drawn over the car
+	// (without the calibration) must hide it and leave the distractor. Counts are of blobs within the first car's size
+	// range.
+	long n_static_failed = 0;
+	if (!cars_all.empty()) {
+		const Car &car = cars_all[0];
+		Scalar colour = car_colour(car);
+		int area = (car.size_min + car.size_max)/2;
+		Rect patch(config.crop + 10, config.crop + 10, sqrt(area*1.25f), sqrt(area/1.25f));	// a corner clear of the loops
+		SyntheticScene empty;
+		empty.open_scene(vector<Car>(), Size(IMG_WIDTH, IMG_HEIGHT), config.crop, BENCH_NOISE, BENCH_LIGHTING);
+		StaticMask mask;
+		float origin[2] = {config.origin[0], config.origin[1]};
+		mask.open_mask("", src.size(), 1, 1, vector<Obstacle>(), config.scale, origin, 0);
+		mask.start_calibration(BENCH_STATIC);
+		Mat frame, labels_static = Mat::zeros(IMG_HEIGHT, IMG_WIDTH, CV_8UC1);
+		Mat rows_static = Mat::zeros(CLASSIFY_ROWS, IMG_WIDTH + 2, CV_8UC1);
+		for (int i = 0; i < BENCH_STATIC; i++) {
+			empty.render(double (i)/SCENE_FPS, frame);
+			frame(patch).setTo(colour);
+			mask.calibrate(frame, rows_static, lut, config.crop);
+		}
+
+		// Frame with the car and the distractor, without and with the mask
+		scene.render(0, frame);
+		frame(patch).setTo(colour);
+		Rect whole(0, 0, IMG_WIDTH, IMG_HEIGHT);
+		BlobFinder finder_static;
+		do_classify(frame, labels_static, rows_static, lut, config.crop, whole);
+		int n_unmasked = count_candidates(labels_static, car, finder_static);
+		tick = cv::getTickCount();
+		for (int it = 0; it < iterations; it++) do_classify(frame, labels_static, rows_static, lut, config.crop, whole, 1, mask.keep);
+		double time_masked = time_ms(tick, iterations);
+		int n_masked = count_candidates(labels_static, car, finder_static);
+		Car found = car;
+		find_car(labels_static, 1, found, Point(0, 0), finder_static);
+		SceneTruth truth = scene.truth(0, 0);
+		double error = sqrt(pow(found.position_new[0] - truth.x, 2) + pow(found.position_new[1] - truth.y, 2));
+
+		// Obstacle over the car (a square 40 pixels across, given in world coordinates)
+		Obstacle obstacle;
+		for (int i = 0; i < 4; i++) {
+			float x = truth.x + (i == 1 || i == 2 ? 20 : -20), y = truth.y + (i >= 2 ? 20 : -20);
+			obstacle.points.push_back(Point2f(config.scale*(x - config.origin[0]), config.scale*(y - config.origin[1])));
+		}
+		StaticMask obstacle_mask;
+		obstacle_mask.open_mask("", src.size(), 1, 1, vector<Obstacle>(1, obstacle), config.scale, origin, 0);
+		do_classify(frame, labels_static, rows_static, lut, config.crop, whole, 1, obstacle_mask.keep);
+		int n_obstacle = count_candidates(labels_static, car, finder_static);
+
+		if (n_masked != 1 || error > 2 || n_obstacle != n_unmasked - 1) n_static_failed++;
+		printf("static mask: %s candidates %d without, %d with the mask (centroid error %.2f px), %d with an obstacle over the car\n",
+			car.name.c_str(), n_unmasked, n_masked, error, n_obstacle);
+		printf("do_classify with mask:   %8.3f ms/frame\n", time_masked);
+		metrics.add("static_candidates_unmasked", n_unmasked);
+		metrics.add("static_candidates_masked", n_masked);
+		metrics.add("static_obstacle_candidates", n_obstacle);
+		metrics.add("static_centroid_error_px", error);
+		metrics.add("do_classify_masked_ms", time_masked);
+	}
+
+	// Candidate association: distractors of the first car's colour and size are painted along the bottom of a frame,
+	// clear of the loops and after the cars in scan order, so the last blob in range (find_car's choice) is a
+	// distractor, and there are more than MAX_CANDIDATES, so the first car's candidates are capped. With each car's
+	// prediction at its true position the association must still measure every car to within 2 pixels. Collecting and
+	// associating the candidates is timed without and with the distractors, and the distractors are associated again
+	// without a gate (assoc_gate = 0), painted half a delta from the first car's hue with the car expecting their hue, so
+	// that only their distance from its prediction tells them from the car.
+	long n_assoc_failed = 0;
+	if (!cars_all.empty()) {
+		Scalar colour = car_colour(cars_all[0]);
+		int area = (cars_all[0].size_min + cars_all[0].size_max)/2;
+		Size patch(sqrt(area*1.25f), sqrt(area/1.25f));
+		Mat frame, labels_assoc = Mat::zeros(IMG_HEIGHT, IMG_WIDTH, CV_8UC1);
+		Mat rows_assoc = Mat::zeros(CLASSIFY_ROWS, IMG_WIDTH + 2, CV_8UC1);
+		Rect whole(0, 0, IMG_WIDTH, IMG_HEIGHT);
+		vector<Car> cars_assoc = cars_all;
+		Config config_ungated = config;
+		config_ungated.assoc_gate = 0;
+		for (int i = 0; i < cars_assoc.size(); i++) {
+			SceneTruth truth = scene.truth(i, 0);
+			cars_assoc[i].n_tracked = 1;
+			cars_assoc[i].position_pred[0] = truth.x;
+			cars_assoc[i].position_pred[1] = truth.y;
+		}
+		double time_clean = 0;
+		for (int pass = 0; pass < 3; pass++) {
+			int n_distractors = pass > 0 ? BENCH_DISTRACTORS : 0;
+			bool gated = pass < 2;
+			if (!gated) {
+				cars_assoc[0].hue = (cars_all[0].hue + cars_all[0].delta/2) % 180;
+				colour = car_colour(cars_assoc[0]);
+			}
+			scene.render(0, frame);
+			for (int d = 0; d < n_distractors; d++) {
+				frame(Rect(config.crop + 10 + d*(patch.width + 10), IMG_HEIGHT - config.crop - 10 - patch.height, patch.width,
+					patch.height) & whole).setTo(colour);
+			}
+			do_classify(frame, labels_assoc, rows_assoc, lut, config.crop, whole);
+			tick = cv::getTickCount();
+			for (int it = 0; it < iterations; it++) {
+				for (int i = 0; i < cars_assoc.size(); i++) {
+					find_candidates(labels_assoc, 1 << i, i, cars_assoc[i], Point(0, 0), finder, association.candidates,
+						association.n_overflow);
+				}
+				association.associate(cars_assoc, gated ? config : config_ungated, frame, lut);
+			}
+			double time_assoc = time_ms(tick, iterations);
+			double error = 0;
+			for (int i = 0; i < cars_assoc.size(); i++) {
+				SceneTruth truth = scene.truth(i, 0);
+				double e = cars_assoc[i].area_new < 0 ? 1e9 :
+					sqrt(pow(cars_assoc[i].position_new[0] - truth.x, 2) + pow(cars_assoc[i].position_new[1] - truth.y, 2));
+				error = max(error, e);
+			}
+			Car last = cars_all[0];
+			find_car(labels_assoc, 1, last, Point(0, 0), finder);
+			SceneTruth truth = scene.truth(0, 0);
+			double error_last = last.area_new < 0 ? 1e9 : sqrt(pow(last.position_new[0] - truth.x, 2) + pow(last.position_new[1] - truth.y, 2));
+			if (error > 2) n_assoc_failed++;
+			printf("association, %d distractors%s: %8.3f ms/frame (%.2fx), largest centroid error %.2f px (last blob in range: %.1f px)\n",
+				n_distractors, gated ? "" : " (no gate)", time_assoc, n_distractors > 0 ? time_assoc/time_clean : 1.0, error,
+				error_last);
+			if (n_distractors == 0) {
+				time_clean = time_assoc;
+				metrics.add("associate_ms", time_assoc);
+			} else if (!gated) {
+				metrics.add("associate_ungated_ms", time_assoc);
+				metrics.add("associate_ungated_error_px", error);
+			} else {
+				metrics.add("associate_distractors_ms", time_assoc);
+				metrics.add("associate_distractors_error_px", error);
+				metrics.add("last_blob_distractors_error_px", error_last);
+			}
+		}
+	}
+
+	// Shared-memory state: a reader copies snapshots (shm_read_state) while a writer thread updates the block as fast as
+	// it can (ShmWriter::write_state); a snapshot mixing values of two states is a torn read, which the seqlock must
+	// prevent. The test runs for a fixed time so that, even on one core, the writer is often preempted part way through
+	// an update (a reader copying the block without the seqlock fails it)
+	long n_torn = 0, n_snapshots = 0, n_written = 0;
+	{
+		string shm_name = "/shmo_bench_" + to_string(getpid());
+		vector<Car> cars_shm = cars_all;
+		ShmWriter shm_writer;
+		ShmReader reader;
+		if (shm_writer.open_writer(shm_name, cars_shm, 0) && shm_open_reader(&reader, shm_name.c_str())) {
+			atomic<bool> stop(false);
+			thread writing(shm_write_frames, &shm_writer, &cars_shm, &stop, &n_written);
+			ShmState snapshot;
+			double tick_end = cv::getTickCount() + BENCH_SHM_MS/1000.0*cv::getTickFrequency();
+			while (cv::getTickCount() < tick_end) {
+				if (!shm_read_state(&reader, &snapshot)) continue;	// nothing written yet
+				n_snapshots++;
+				if (!shm_consistent(snapshot)) n_torn++;
+			}
+			stop.store(true);
+			writing.join();
+			shm_close_reader(&reader);
+		} else {
+			cout << "Error: could not open shared-memory segment " << shm_name << " for the seqlock test" << endl;
+			n_torn = 1;
+		}
+		shm_writer.close_writer();
+	}
+	printf("shared-memory seqlock: %ld torn snapshots of %ld read during %ld writes\n", n_torn, n_snapshots, n_written);
+	metrics.add("shm_snapshots", n_snapshots);
+	metrics.add("shm_torn_snapshots", n_torn);
+
+	// Steady-state frame path: once warmed up nothing may allocate, as allocator jitter shows up in the p99 latency
+	// Run through a camera worker's detection and the publishing stage's merging, tracking and outputs: serially, with
+	// motion gating and with parallel detection
+	Mat moved = src.clone();
+	Mat shifted = moved(Rect(8, 4, src.cols - 8, src.rows - 4));
+	src(Rect(0, 0, src.cols - 8, src.rows - 4)).copyTo(shifted);	// every car moved by (8, 4) pixels
+	long n_steady = 0;
+	for (int variant = 0; variant < 3; variant++) {
+		Config steady = config;
+		steady.motion_tile = variant == 1 ? 32 : 0;
+		steady.detect_threads = variant == 2 ? 4 : 1;
+		CameraConfig camera;
+		camera.crop = config.crop;
+		camera.origin[0] = config.origin[0];
+		camera.origin[1] = config.origin[1];
+		camera.scale = config.scale;
+		CameraWorker worker;
+		worker.source = new SyntheticSource(src, moved);
+		if (!worker.open_worker(0, camera, steady, cars_all)) return 1;
+		Frame frame;
+		frame.image = Mat::zeros(src.rows, src.cols, src.type());
+		Result result;
+		result.cars_all = cars_all;
+		Result *results[1] = {&result};
+		vector<Car> cars_world = cars_all;
+		Logger logger;
+		logger.open_log("bench_log.bin", cars_all.size());
+		ShmWriter shm_writer;
+		shm_writer.open_writer("/shmo_bench", cars_world, cv::getTickCount());
+		Publisher publisher;
+		publisher.open_publisher(cars_world, steady, 4);
+
+		long n_before = 0;
+		tick = cv::getTickCount();
+		for (int it = 0; it < BENCH_WARMUP + iterations; it++) {
+			if (it == BENCH_WARMUP) {
+				n_before = n_allocations.load();
+				tick = cv::getTickCount();
+			}
+			worker.source->read(frame);
+			frame.seq = it;
+			frame.time_read = frame.time;
+			worker.detect(frame, result);
+			merge_results(cars_world, results, 1, steady.merge_distance, result.time);
+			for (int i = 0; i < cars_world.size(); i++) do_track(cars_world[i], steady, result.time);
+			logger.log(cars_world, result.time, 0);
+			shm_writer.write_state(cars_world, it, result.time);
+			publisher.format_json(cars_world, it, 0, 0, 0);
+			publisher.format_binary(cars_world, it, 0, 0, 0);
+		}
+		long n_counted = n_allocations.load() - n_before;
+		double time_steady = time_ms(tick, iterations);
+		n_steady += n_counted;
+
+		logger.close_log();
+		unlink("bench_log.bin");
+		shm_writer.close_writer();
+		worker.close_worker();
+		printf("steady-state frame path%s: %8.3f ms/frame, %ld heap allocations in %i frames\n",
+			variant == 1 ? " (motion gating)" : variant == 2 ? " (4 threads)" : "", time_steady, n_counted, iterations);
+		metrics.add(variant == 1 ? "steady_gated_ms" : variant == 2 ? "steady_threads4_ms" : "steady_ms", time_steady);
+	}
+	metrics.add("steady_allocations", n_steady);
+
+	bool passed = n_mismatch == 0 && n_blob_mismatch == 0 && n_parallel_mismatch == 0
+		&& n_static_failed == 0 && n_assoc_failed == 0 && n_torn == 0 && n_snapshots > 0 && n_steady == 0;
+	metrics.add("passed", passed);
+	if (metrics.save(results_name)) {
+		cout << "Results written to " << results_name << endl;
+	} else {
+		cout << "Error: could not write " << results_name << endl;
+	}
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,249 @@
+// Header include guard
+#ifndef BLOBS_H	// if blobs.h has not been included, include it, otherwise do not
+#define BLOBS_H	// see end of file for corresponding #endif
+
+// General includes
+#include <vector>		// vector
+#include <limits.h>		// INT_MAX
+
+// OpenCV includes
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "parallel.hpp"	// stripe pool
+
+// Namespaces
+using namespace std;
+using namespace cv;
+
+// Blob definitions:
+#define BLOB_RESERVE		4096	// runs/components the extractor has room for before it has to grow its buffers
+
+
+// Connected component (8-connected) statistics
+struct Blob {
+	int pixels;					// number of pixels
+	int boundary;				// pixels with a 4-connected background neighbour
+	int x_min, y_min;			// bounding box (inclusive)
+	int x_max, y_max;
+	long sum_x, sum_y;			// first moments (sums of pixel coordinates)
+
+	float area(void) const
+	// Area by Pick's theorem over the blob's pixels, so size_min/size_max keep their meaning: for a solid blob this is
+	// the area contourArea reports for its outer contour (the polygon through the centres of the boundary pixels).
+	// It differs for other shapes: a hole takes its own pixels and half its rim off the area (contourArea of the outer
+	// contour ignores holes), and each pixel of a part one pixel wide adds half a pixel (contourArea adds none).
+	{
+		float a = pixels - boundary/2.0f - 1;
+		return a > 0 ? a : 0;
+	}
+	float x(void) const { return float (sum_x) / pixels; }		// centroid
+	float y(void) const { return float (sum_y) / pixels; }
+	Rect box(void) const { return Rect(x_min, y_min, x_max - x_min + 1, y_max - y_min + 1); }
+};
+
+
+// Single-pass blob extractor
+// Scans a label image once, row by row, splitting each row into runs of pixels with the requested bit set. Each run is
+// joined (union-find) to the runs it touches in the row above and its statistics are added to its component as it is
+// found, so no mask copy, contour tracing or per-component allocation is needed. Buffers are kept between calls.
+// Given a stripe pool (use_pool), large images are scanned in horizontal stripes in parallel, each by its own
+// extractor; components meeting across a stripe boundary are then joined through the runs of the rows either side
+// of it. Components are numbered in scan order either way, so the blobs (and their order) are identical to a serial
+// scan.
+struct BlobFinder : StripeJob {
+	vector<int> parent;			// union-find parent of each provisional component
+	vector<Blob> stats;			// statistics accumulated for each provisional component
+	vector<int> runs_prev;		// runs in the previous row: x_start, x_end, component (3 ints per run)
+	vector<int> runs_cur;		// runs in the current row
+	vector<int> runs_first;		// runs in the first row scanned (joined to the stripe above)
+	vector<Blob> blobs;			// output: one entry per connected component
+	StripePool *pool;			// threads to scan stripes with (NULL to scan serially)
+	vector<BlobFinder *> parts;	// extractor for each stripe
+	Mat stripe_labels;			// image being scanned in stripes, with its bit and offset
+	int stripe_bit;
+	Point stripe_offset;
+
+	BlobFinder() : pool(NULL), stripe_bit(0) {
+		parent.reserve(BLOB_RESERVE);
+		stats.reserve(BLOB_RESERVE);
+		runs_prev.reserve(3*BLOB_RESERVE);
+		runs_cur.reserve(3*BLOB_RESERVE);
+		runs_first.reserve(3*BLOB_RESERVE);
+		blobs.reserve(BLOB_RESERVE);
+	}
+
+	~BlobFinder() {
+		for (int i = 0; i < parts.size(); i++) delete parts[i];
+	}
+
+	void use_pool(StripePool *stripe_pool)
+	// Scan large images in stripes on the pool's threads
+	{
+		pool = stripe_pool;
+		while (parts.size() < pool->n_threads()) parts.push_back(new BlobFinder());
+		return;
+	}
+
+	int root(int c)
+	// Representative component of c (with path halving)
+	{
+		while (parent[c] != c) {
+			parent[c] = parent[parent[c]];
+			c = parent[c];
+		}
+		return c;
+	}
+
+	void join(int a, int b)
+	// Merge the components containing a and b
+	{
+		a = root(a);
+		b = root(b);
+		if (a < b) parent[b] = a;
+		if (b < a) parent[a] = b;
+		return;
+	}
+
+	void find(Mat labels, int bit, Point offset)
+	// Find the connected components of the pixels of labels with bit set
+	// Coordinates are reported relative to the full image (labels may be part of it, starting at offset)
+	{
+		int n_stripes = stripes_for(pool, labels.rows);
+		if (n_stripes == 1) {
+			scan(labels, bit, offset, 0, labels.rows);
+			resolve();
+			return;
+		}
+		stripe_labels = labels;
+		stripe_bit = bit;
+		stripe_offset = offset;
+		pool->run(*this, n_stripes);
+		join_stripes(n_stripes);
+		resolve();
+		return;
+	}
+
+	void run(int stripe, int n_stripes)
+	// Scan one stripe of the image given to find (on a pool thread)
+	{
+		int y_begin = stripe_start(stripe_labels.rows, stripe, n_stripes);
+		int y_end = stripe_start(stripe_labels.rows, stripe + 1, n_stripes);
+		parts[stripe]->scan(stripe_labels, stripe_bit, stripe_offset, y_begin, y_end);
+		return;
+	}
+
+	void scan(Mat labels, int bit, Point offset, int y_begin, int y_end)
+	// Split rows y_begin to y_end - 1 of labels into runs, each joined to the runs it touches in the row above (within
+	// these rows), and accumulate their statistics into provisional components
+	{
+		parent.clear();
+		stats.clear();
+		runs_prev.clear();
+		runs_first.clear();
+
+		for (int y = y_begin; y < y_end; y++) {
+			const uchar *row = labels.ptr<uchar>(y);
+			const uchar *above = y > 0 ? labels.ptr<uchar>(y - 1) : NULL;
+			const uchar *below = y < labels.rows - 1 ? labels.ptr<uchar>(y + 1) : NULL;
+			runs_cur.clear();
+			int j = 0;	// first run in the previous row that may still touch the current one
+
+			for (int x = 0; x < labels.cols; x++) {
+				if (!(row[x] & bit)) continue;
+
+				// Extent of the run
+				int x_start = x;
+				while (x + 1 < labels.cols && (row[x + 1] & bit)) x++;
+				int x_end = x;
+
+				// New provisional component for the run, joined to every run it touches in the row above
+				int c = parent.size();
+				parent.push_back(c);
+				while (j < runs_prev.size() && runs_prev[j + 1] < x_start - 1) j += 3;
+				for (int k = j; k < runs_prev.size() && runs_prev[k] <= x_end + 1; k += 3) {
+					join(c, runs_prev[k + 2]);
+				}
+				runs_cur.push_back(x_start);
+				runs_cur.push_back(x_end);
+				runs_cur.push_back(c);
+
+				// Run statistics (the ends are always boundary pixels, the rest are if above or below is background)
+				Blob b;
+				b.pixels = x_end - x_start + 1;
+				b.boundary = b.pixels < 3 ? b.pixels : 2;
+				for (int xx = x_start + 1; xx < x_end; xx++) {
+					if (above == NULL || below == NULL || !(above[xx] & bit) || !(below[xx] & bit)) b.boundary++;
+				}
+				b.x_min = x_start + offset.x;
+				b.x_max = x_end + offset.x;
+				b.y_min = b.y_max = y + offset.y;
+				b.sum_x = (long)(b.x_min + b.x_max)*b.pixels/2;
+				b.sum_y = (long)b.y_min*b.pixels;
+				stats.push_back(b);
+			}
+			if (y == y_begin) runs_first.assign(runs_cur.begin(), runs_cur.end());
+			runs_prev.swap(runs_cur);
+		}
+		return;
+	}
+
+	void join_stripes(int n_stripes)
+	// Gather the components of the stripes scanned by parts (top to bottom), renumbered in scan order, and join those
+	// that touch across each boundary
+	{
+		parent.clear();
+		stats.clear();
+		int base_above = 0;
+		for (int s = 0; s < n_stripes; s++) {
+			const BlobFinder &part = *parts[s];
+			int base = parent.size();
+			for (int c = 0; c < part.parent.size(); c++) parent.push_back(part.parent[c] + base);
+			stats.insert(stats.end(), part.stats.begin(), part.stats.end());
+
+			// The last row of the stripe above against the first row of this one (8-connected, as in scan)
+			if (s > 0) {
+				const vector<int> &above = parts[s - 1]->runs_prev, &below = part.runs_first;
+				int j = 0;
+				for (int i = 0; i < below.size(); i += 3) {
+					while (j < above.size() && above[j + 1] < below[i] - 1) j += 3;
+					for (int k = j; k < above.size() && above[k] <= below[i + 1] + 1; k += 3) {
+						join(below[i + 2] + base, above[k + 2] + base_above);
+					}
+				}
+			}
+			base_above = base;
+		}
+		return;
+	}
+
+	void resolve(void)
+	// Merge statistics into each component's root and emit the roots as blobs
+	{
+		blobs.clear();
+		vector<int> &index = runs_cur;	// reused as root -> output blob index
+		index.assign(parent.size(), -1);
+		for (int c = 0; c < parent.size(); c++) {
+			int r = root(c);
+			if (index[r] < 0) {
+				index[r] = blobs.size();
+				blobs.push_back(stats[c]);
+				continue;
+			}
+			Blob &b = blobs[index[r]];
+			const Blob &s = stats[c];
+			b.pixels += s.pixels;
+			b.boundary += s.boundary;
+			b.x_min = min(b.x_min, s.x_min);
+			b.x_max = max(b.x_max, s.x_max);
+			b.y_min = min(b.y_min, s.y_min);
+			b.y_max = max(b.y_max, s.y_max);
+			b.sum_x += s.sum_x;
+			b.sum_y += s.sum_y;
+		}
+		return;
+	}
+};
+
+
+
+#endif
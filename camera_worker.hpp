@@ -0,0 +1,402 @@
+// Header include guard
+#ifndef CAMERA_WORKER_H	// if camera_worker.h has not been included, include it, otherwise do not
+#define CAMERA_WORKER_H	// see end of file for corresponding #endif
+
+// General includes
+#include <iostream>		// cout
+#include <thread>		// thread
+
+// Algorithm-specific includes
+#include "shmo.hpp"			// specific to this algorithm
+#include "common.hpp"		// common definitions
+#include "pipeline.hpp"		// frame/result channels between threads
+#include "frame_source.hpp"	// camera and recordings
+#include "stats.hpp"		// latency statistics
+#include "control.hpp"		// pausing and config reloads
+#include "motion.hpp"		// per-tile change detection
+#include "static_mask.hpp"	// static distractor exclusion
+#include "associate.hpp"	// candidate association
+
+// Namespaces
+using namespace std;
+using namespace cv;
+
+
+// Per-camera capture and detection
+// Each camera has its own capture and detection threads, so cameras are processed in parallel. Detections are converted
+// to world coordinates with the camera's own calibration and handed on as measurements (before tracking); they are
+// merged with the other cameras' and tracked by the publishing stage (see merge_results). Each worker also tracks the
+// cars it sees itself, which only serves to place its search windows.
+struct CameraWorker {
+	int index;					// camera number (order in config.txt)
+	Config config;				// global parameters with this camera's crop, origin and scale
+	FrameSource *source;
+	ArchiveWriter recorder;
+	Stats stats;				// grab, retrieve, classify and find timings for this camera
+	Channel<Frame> frames;		// capture -> detection
+	Channel<Result> results;	// detection -> merging (measurements in world coordinates, area -1 if not found)
+	vector<Car> cars_all;		// this camera's view of the cars
+	vector<uchar> lut;			// BGR (or chroma) -> car lookup table
+	Mat labels;					// car label image (one bit per car)
+	Mat labels_small;			// coarse search labels (labels itself at full resolution)
+	Mat labels_tmp;				// scratch rows for do_classify
+	int step;					// label decimation (2 for I420 frames, which are labelled on their chroma planes)
+	bool refine;				// decimated BGR search, refined at full resolution
+	MotionGate gate;			// dirty tiles (tile 0 if motion gating is disabled)
+	StaticMask mask;			// car bits kept at each pixel (static distractors and obstacles removed)
+	atomic<bool> calibrate_requested;	// calibrate the static mask from the next frames (control thread)
+	vector<Rect> tiles;			// dirty tile rectangles being classified
+	BlobFinder finder, finder_fine;	// blob extractors (finder_fine for full resolution windows when decimating)
+	StripePool pool;			// threads sharing the stripes of each frame (detect_threads in config.txt)
+	ClassifyStripes classifier;	// do_classify in stripes
+	Association association;	// this frame's candidates, and the choices made between them
+	vector<Point2f> last_position;	// each car's last measured position (pixels), reused while nothing near it changes
+	long n_reused;				// measurements reused because nothing near the car changed
+	thread capture, detection;
+	atomic<bool> stopping;		// set to end capture early (daemon mode)
+	const atomic<bool> *paused;	// detection is skipped while set (NULL if tracking is never paused)
+	atomic<Tuning *> tuning;	// reloaded parameters waiting to be swapped in (NULL if none)
+	RetiredTunings retired;		// parameters swapped out, freed by the control thread (see retune)
+
+	CameraWorker() : index(0), source(NULL), frames(PIPE_FRAMES), results(PIPE_RESULTS), step(1), refine(false),
+		calibrate_requested(false), n_reused(0), stopping(false), paused(NULL), tuning(NULL) {}
+
+	bool open_worker(int idx, const CameraConfig &camera, const Config &global, const vector<Car> &cars)
+	// Open the camera's frame source and allocate its buffers (a source set beforehand, e.g. by the benchmarks, is used
+	// instead of the configured one)
+	{
+		index = idx;
+		config = global;
+		config.crop = camera.crop;
+		config.origin[0] = camera.origin[0];
+		config.origin[1] = camera.origin[1];
+		config.scale = camera.scale;
+		cars_all = cars;
+
+		// Frame source setup
+		if (source == NULL) source = make_source(camera.source, config);
+		if (source == NULL || !source->open_source()) {
+			cerr<<"Error: could not open camera "<<index + 1<<" ("<<camera.source<<")"<<endl;
+			return false;
+		}
+		source->stats = &stats;
+		if (source->type != (source->i420 ? CV_8UC1 : CV_8UC3)) {
+			cerr<<"Error: frames must be 8-bit BGR or I420"<<endl;
+			return false;
+		}
+		if (source->i420 && config.decimation > 1) {
+			cout<<"WARNING: I420 frames are labelled at chroma resolution, decimation is ignored"<<endl;
+			config.decimation = 1;
+		}
+		if (!camera.record.empty()) {
+			recorder.open_archive(camera.record.c_str(), source->size, source->type, source->i420);
+		}
+
+		// Allocate frame buffers and label images
+		Size size = source->size;
+		labels = Mat::zeros(size.height, size.width, CV_8UC1);
+		labels_tmp = Mat::zeros(CLASSIFY_ROWS, size.width + 2, CV_8UC1);
+		step = source->i420 ? 2 : config.decimation;
+		refine = step > 1 && !source->i420;
+		labels_small = step > 1 ? Mat::zeros(size.height/step, size.width/step, CV_8UC1) : labels;
+		Size image_size = source->image_size();
+		for (int i = 0; i < frames.buffers.size(); i++) {
+			frames.buffers[i].image = Mat::zeros(image_size.height, image_size.width, source->type);
+		}
+		for (int i = 0; i < results.buffers.size(); i++) {
+			results.buffers[i].cars_all = cars_all;
+		}
+
+		// Parallel detection: whole-frame labelling and blob search are split into stripes
+		int n_threads = max(config.detect_threads, 1);
+		pool.open_pool(n_threads);
+		classifier.open_stripes(labels_small.cols, n_threads);
+		if (n_threads > 1) finder.use_pool(&pool);
+
+		// Static scene exclusion (loaded from camera.static_mask, or calibrated from the first frames if it is missing)
+		mask.open_mask(camera.static_mask, size, source->i420 ? 2 : 1, step, config.obstacles, config.scale, config.origin,
+			config.static_frames);
+
+		// Motion gating
+		if (config.motion_tile > 0) {
+			gate.open_gate(size, config.motion_tile, config.motion_threshold);
+			tiles.reserve(gate.nx*gate.ny);
+		}
+		last_position.assign(cars_all.size(), Point2f(0, 0));
+		association.open_association(cars_all.size());
+
+		// Build BGR (or chroma) -> car lookup table
+		if (source->i420) {
+			do_lut_uv(cars_all, lut);
+		} else {
+			do_lut(cars_all, lut);
+		}
+		return true;
+	}
+
+	void start(long n_frames)
+	// Start the capture and detection threads (n_frames <= 0 to capture until stop() is called)
+	{
+		capture = thread(&CameraWorker::capture_loop, this, n_frames);
+		detection = thread(&CameraWorker::detection_loop, this);
+		return;
+	}
+
+	void stop(void)
+	// End capture after the current frame, the threads then finish once their queued frames are processed
+	{
+		stopping = true;
+		return;
+	}
+
+	void retune(Tuning *t)
+	// Hand reloaded parameters (with a lookup table for this camera's frame format) to the detection thread
+	{
+		delete tuning.exchange(t);		// replaces parameters that have not been swapped in yet
+		retired.free_all();
+		return;
+	}
+
+	void capture_loop(long n_frames)
+	// Capture stage: never waits for detection - if it falls behind the oldest waiting frame is dropped
+	{
+		for (long ii = 0; (n_frames <= 0 || ii < n_frames) && !stopping.load(memory_order_relaxed); ii++) {
+			Frame &frame = frames.write_slot();
+			frame.time_capture = 0;
+			if (!source->read(frame)) break;	// end of recording
+			frame.time_read = cv::getTickCount();
+			if (frame.time_capture == 0) frame.time_capture = pub_clock_us();	// recordings: when the frame was read
+			frame.seq = ii;
+			recorder.record(frame);
+			frames.push();
+		}
+		frames.close();
+		return;
+	}
+
+	void detection_loop(void)
+	// Detection stage: find every car in each frame and hand the measurements on
+	{
+		Frame *frame;
+		bool was_paused = false;
+		while ((frame = frames.wait_pop()) != NULL) {
+			// Swap in reloaded parameters between frames (the lookup table is swapped, not copied)
+			Tuning *t = tuning.exchange(NULL);
+			if (t != NULL) {
+				do_retune(cars_all, config, *t);
+				lut.swap(t->lut);
+				retired.retire(t);
+				if (gate.tile > 0) gate.invalidate();	// labels from the old table are out of date
+			}
+
+			// While paused frames are still captured (keeping the camera running) but not searched
+			if (paused != NULL && paused->load(memory_order_relaxed)) {
+				was_paused = true;
+				continue;
+			}
+			if (was_paused) {
+				do_reset_tracks(cars_all);
+				was_paused = false;
+			}
+			if (calibrate_requested.exchange(false)) {
+				cout << "Calibrating the static mask of camera " << index + 1 << " from the next " << config.static_frames << " frames" << endl;
+				mask.start_calibration(config.static_frames);
+			}
+
+			detect(*frame, results.write_slot());
+			results.push();
+		}
+		results.close();
+		return;
+	}
+
+	void detect(const Frame &frame, Result &result)
+	// Find every car in one frame and write the measurements (in world coordinates) to result
+	// Nothing is allocated here once the buffers have grown to their working sizes
+	{
+		Mat src = frame.image;
+		double time_new = frame.time;
+		Size size = source->size;
+
+		// Choose search windows, the full frame is labelled if any car needs it
+		bool full_frame = false;
+		for (int jj = 0; jj < cars_all.size(); jj++) {
+			do_roi(cars_all[jj], config, size, frame.seq, time_new);
+			if (cars_all[jj].roi.area() == size.area()) {
+				full_frame = true;
+			}
+		}
+
+		// Label matching hues for all cars at once (on the decimated image if decimating)
+		double tick = cv::getTickCount();
+		Rect small_full(0, 0, labels_small.cols, labels_small.rows);
+		if (mask.calibrate(src, labels_tmp, lut, config.crop) && gate.tile > 0) {
+			gate.invalidate();	// labels classified before the new mask need classifying again
+		}
+		if (gate.tile > 0) {
+			gate.update(src, source->i420);
+		}
+		if (full_frame) {
+			classify_region(src, Rect(0, 0, size.width, size.height));
+		} else {
+			for (int jj = 0; jj < cars_all.size(); jj++) {
+				classify_region(src, cars_all[jj].roi);
+			}
+		}
+		double tick_classified = cv::getTickCount();
+		stats.record(STAGE_CLASSIFY, tick, tick_classified);
+
+		// Collect each car's candidates (when decimating this includes labelling the full resolution windows around them)
+		int searched = 0;		// cars searched for (bit i for cars_all[i])
+		for (int jj = 0; jj < cars_all.size(); jj++) {
+			Car &car = cars_all[jj];
+			if (gate.tile > 0 && car.n_tracked > 0 && car.n_coast == 0 && car.blob.area() > 0 && !gate.touched(car.blob, 2*step)) {
+				// Nothing near the car's blob has been classified again, so its measurement is unchanged
+				car.position_new[0] = last_position[jj].x;
+				car.position_new[1] = last_position[jj].y;
+				car.area_new = car.area_old;
+				n_reused++;
+				continue;
+			}
+			searched |= 1 << jj;
+			if (refine) {
+				find_candidates_decimated(src, labels, labels_small, labels_tmp, lut, config.crop, step, 1 << jj, jj, car, finder,
+					finder_fine, association.candidates, association.n_overflow, mask.keep);
+			} else {
+				Rect roi = scale_rect(car.roi, step) & small_full;
+				find_candidates(labels_small(roi), 1 << jj, jj, car, roi.tl(), finder, association.candidates,
+					association.n_overflow, step);
+			}
+		}
+		
+		// Give each car the best of its candidates that no other car has a better claim to
+		association.associate(cars_all, config, src, lut, searched);
+		for (int jj = 0; jj < cars_all.size(); jj++) {
+			if (searched & (1 << jj)) last_position[jj] = Point2f(cars_all[jj].position_new[0], cars_all[jj].position_new[1]);
+		}
+		stats.record(STAGE_FIND, tick_classified, cv::getTickCount());
+		association.warn(index + 1, time_new);
+
+		// Hand the measurements (in world coordinates) to the merging stage
+		for (int jj = 0; jj < cars_all.size(); jj++) {
+			cars_all[jj].px_to_mm(config.scale, config.origin);
+			result.cars_all[jj].area_new = cars_all[jj].area_new;
+			result.cars_all[jj].position_new[0] = cars_all[jj].position_new[0];
+			result.cars_all[jj].position_new[1] = cars_all[jj].position_new[1];
+
+			// This camera's own estimate, for its search windows
+			do_track(cars_all[jj], config, time_new);
+		}
+		result.seq = frame.seq;
+		result.time = time_new;
+		result.time_read = frame.time_read;
+		result.time_capture = frame.time_capture;
+		return;
+	}
+
+	void classify_region(Mat src, Rect region)
+	// Label matching hues in a region of the full image (with motion gating, only in the region's dirty tiles)
+	{
+		Rect small_full(0, 0, labels_small.cols, labels_small.rows);
+		if (gate.tile == 0) {
+			classifier.classify(&pool, src, labels_small, lut, config.crop, scale_rect(region, step) & small_full, step, mask.keep_small);
+			return;
+		}
+		gate.dirty_rects(region, tiles);
+		for (int i = 0; i < tiles.size(); i++) {
+			do_classify(src, labels_small, labels_tmp, lut, config.crop, scale_rect(gate.halo(tiles[i]), step) & small_full, step,
+				mask.keep_small);
+			gate.mark_classified(src, source->i420, tiles[i]);
+		}
+		return;
+	}
+
+	void join(void)
+	// Wait for the threads to finish
+	{
+		if (capture.joinable()) capture.join();
+		if (detection.joinable()) detection.join();
+		return;
+	}
+
+	void close_worker(void)
+	// Finish recording and release the frame source
+	{
+		recorder.close_archive();
+		pool.close_pool();
+		delete tuning.exchange(NULL);
+		retired.free_all();
+		if (source != NULL) {
+			source->release();
+			delete source;
+			source = NULL;
+		}
+		return;
+	}
+};
+
+
+void merge_results(vector<Car> &cars_all, Result *results[], int n_cameras, float merge_distance, double time_new)
+// This function combines the cameras' measurements of each car into one measurement in cars_all (position_new and
+// area_new, ready for do_track)
+// A car seen by several cameras (in an overlap region) is measured at the area-weighted mean of their positions. If
+// the measurements are further apart than merge_distance one of them is a false detection, so the one nearest the car's
+// predicted position (or the largest, if it is not being tracked) is used instead.
+// results	each camera's newest measurements (NULL for cameras without a new result)
+{
+	for (int i = 0; i < cars_all.size(); i++) {
+		Car &car = cars_all[i];
+		float sum_area = 0, sum_x = 0, sum_y = 0;
+		float x_min = 0, x_max = 0, y_min = 0, y_max = 0;
+		int n_found = 0, best = -1;
+		float best_score = 0;
+
+		// Predicted position, to choose between conflicting measurements
+		double time_inc = double (time_new - car.time_est) / double (cv::getTickFrequency());
+		float predicted[2] = {car.position_est[0] + car.velocity_est[0]*(float)time_inc,
+			car.position_est[1] + car.velocity_est[1]*(float)time_inc};
+
+		for (int c = 0; c < n_cameras; c++) {
+			if (results[c] == NULL) continue;
+			const Car &m = results[c]->cars_all[i];
+			if (m.area_new <= 0) continue;
+			float x = m.position_new[0], y = m.position_new[1];
+			sum_area += m.area_new;
+			sum_x += m.area_new*x;
+			sum_y += m.area_new*y;
+			x_min = n_found == 0 ? x : min(x_min, x);
+			x_max = n_found == 0 ? x : max(x_max, x);
+			y_min = n_found == 0 ? y : min(y_min, y);
+			y_max = n_found == 0 ? y : max(y_max, y);
+			float score = car.n_tracked > 0 ? -(pow(x - predicted[0], 2) + pow(y - predicted[1], 2)) : m.area_new;
+			if (best < 0 || score > best_score) {
+				best = c;
+				best_score = score;
+			}
+			n_found++;
+		}
+
+		if (n_found == 0) {
+			// Not seen by any camera
+			car.position_new[0] = 0;
+			car.position_new[1] = 0;
+			car.area_new = -1;
+		} else if (x_max - x_min > merge_distance || y_max - y_min > merge_distance) {
+			// Conflicting measurements, use the most plausible
+			const Car &m = results[best]->cars_all[i];
+			car.position_new[0] = m.position_new[0];
+			car.position_new[1] = m.position_new[1];
+			car.area_new = m.area_new;
+		} else {
+			// One car seen by one or more cameras
+			car.position_new[0] = sum_x/sum_area;
+			car.position_new[1] = sum_y/sum_area;
+			car.area_new = sum_area/n_found;
+		}
+	}
+	return;
+}
+
+
+
+#endif
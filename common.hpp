@@ -5,12 +5,16 @@
 // General includes
 #include <string.h>		// to_string, string
 #include <sstream>		// istringstream
+#include <fstream>		// ifstream
 #include <iostream>		// >> operator, cout
 #include <math.h>		// sqrt, atan2, pow
 #include <sys/time.h>		// RB - python timing
 
 // OpenCV and camera includes
-#include "/home/pi/raspicam-0.1.6/src/raspicam_cv.h"
+#ifndef NO_RASPICAM
+#include "raspicam_cv.h"		// camera (raspicam src directory is on the include path, see makefile)
+#include "raspicam.h"			// camera without OpenCV conversion (for I420 capture)
+#endif
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv/highgui.h"
@@ -27,11 +31,108 @@
 #define IMG_GAIN			50
 #define IMG_SHUTTER_SPEED	3.03	// corresponds to approximately 10 ms (1/100 sec shutter speed) which mitigates banding from flourescent light source
 
+// Tracking definitions:
+#define MAX_CARS			8		// maximum number of cars (each car is one bit of a uchar label image)
+
 // Namespaces
 using namespace std;
 using namespace cv;
 
 
+// Per-camera parameters (read from a "Camera = n ... Camera = end" block of config.txt)
+// Each camera's origin and scale map its pixels into the shared world frame (camera axes must be aligned with it)
+struct CameraConfig {
+	string source;				// frame source (see make_source): "camera", a recording or a video stream
+	int crop;					// number of pixels removed from each image edge
+	float origin[2];			// world coordinate system origin in this camera's image (pixels)
+	float scale;				// mm per pixel
+	string record;				// frame archive to record this camera to (empty for no recording)
+	string static_mask;			// file caching this camera's static exclusion mask (see static_mask.hpp), empty for none
+	
+	// Default values
+	CameraConfig() : source("camera"), crop(0), scale(1) {
+		origin[0] = 0;
+		origin[1] = 0;
+	}
+};
+
+
+// Static obstacle (read from an "Obstacle = n ... Obstacle = end" block of config.txt)
+// Pixels inside the polygon are never labelled as a car (see static_mask.hpp)
+struct Obstacle {
+	string name;
+	vector<Point2f> points;		// polygon vertices in the world frame (mm, "point = x y" lines in order)
+};
+
+
+// Global parameters structure (read from config.txt)
+struct Config {
+	int crop;					// number of pixels removed from each image edge
+	float origin[2];			// coordinate system origin (pixels)
+	float scale;				// mm per pixel
+	int min_speed;				// minimum speed (mm/s) at which orientation is calculated
+	
+	// Detection
+	string capture_format;		// "bgr" or "i420" (classify the camera's YUV planes directly, see do_lut_uv)
+	int decimation;				// 1 for full resolution, 2 or 4 to search a decimated image and refine at full resolution
+	
+	// Region-of-interest tracking
+	int roi_size;				// side length (pixels) of each car's search window, 0 to always search the full frame
+	int roi_margin;				// extra pixels added to each side of the search window
+	int roi_reacquire;			// search the full frame every roi_reacquire frames, 0 to do so only when a car is lost
+	
+	// Candidate association (see associate.hpp)
+	float assoc_gate;			// farthest (mm) a candidate may be from a tracked car's prediction, 0 for no gate
+	
+	// Recording and replay
+	string record;				// frame archive to record the session to (empty for no recording)
+	int replay_realtime;		// 1 to replay recordings at their original pace, 0 for as fast as possible
+	
+	// Statistics
+	int stats_interval;			// print latency statistics every stats_interval frames, 0 for only at the end
+	
+	// State estimation (alpha-beta filter, see do_track)
+	float track_alpha;			// position gain, 1 to report raw measured positions
+	float track_beta;			// velocity gain, 1 (with track_alpha = 1) for the raw two-frame velocity
+	int track_coast;			// frames a car is predicted through without a detection before it is reported lost
+	float extrapolate_max;		// longest time (s) published states are extrapolated forward to the send time
+	
+	// Parallel detection (see parallel.hpp)
+	int detect_threads;			// threads labelling and searching each camera's frames in stripes, 1 for serial
+	
+	// Motion gating (see motion.hpp)
+	int motion_tile;			// side (pixels) of the tiles checked for change, 0 to classify every frame in full
+	int motion_threshold;		// largest change of a sampled pixel treated as noise
+	
+	// Static scene exclusion (see static_mask.hpp)
+	string static_mask;			// file caching the calibrated exclusion mask (empty for none, cameras have their own)
+	int static_frames;			// frames of the empty arena combined when calibrating the mask
+	vector<Obstacle> obstacles;	// polygons never searched
+	
+	// Multiple cameras (if none are configured, one camera uses the global crop, origin and scale)
+	vector<CameraConfig> cameras;
+	float merge_distance;		// detections of a car by different cameras further apart than this (mm) are not averaged
+	int merge_wait;				// longest time (ms) to wait for every camera's result before merging without it
+	
+	// Telemetry
+	string publish_format;		// "json" (newline-delimited) or "binary" (length-prefixed, see publish_format.hpp)
+	string shm_name;			// shared-memory segment the newest state is also written to (empty for none)
+	float target_fps;			// most messages sent to the controller per second, 0 to send every frame
+	int publish_backlog;		// bytes the controller may leave unread before frames are skipped, 0 for no limit
+	
+	// Control
+	string control_socket;		// Unix socket accepting control commands (see control.hpp), "none" for no socket
+	
+	// Default values
+	Config() : crop(0), scale(1), min_speed(0), capture_format("bgr"), decimation(1), roi_size(0), roi_margin(0), roi_reacquire(0), assoc_gate(0), replay_realtime(0),
+		stats_interval(0), track_alpha(1), track_beta(1), track_coast(0), extrapolate_max(0), detect_threads(1), motion_tile(0), motion_threshold(20), static_frames(30),
+		merge_distance(50), merge_wait(20), publish_format("json"), target_fps(0), publish_backlog(2048), control_socket("/tmp/shmo.sock") {
+		origin[0] = 0;
+		origin[1] = 0;
+	}
+};
+
+
 // Car object structure
 struct Car {
 	string name;				// car name, usually its colour
@@ -43,45 +144,37 @@ struct Car {
 	int size_min;				// minimum (pixel) area car may appear as
 	int size_max;				// maximum (pixel) area car may appear as
 	
-	// Measured parameters
-	float area_old;				// measured area
-	float area_new;
-	float position_old[2];		// measures position
-	float position_new[2];
-	float velocity_old[2];		// measured velocity
-	float velocity_new[2];
-	int orientation_old;		// measured orientation
-	int orientation_new;
+	// Measured parameters (find_car) and estimated state (do_track)
+	float area_old;				// last measured area
+	float area_new;				// measured area, -1 if not found (last measured area while coasting)
+	float position_new[2];		// measured position, replaced by the estimated position
+	float velocity_new[2];		// estimated velocity
+	int orientation_new;		// estimated orientation (held while the car is slower than min_speed, 0 once lost)
+	
+	// Tracking state
+	Rect roi;					// region of the image searched in the current frame
+	float position_pred[2];		// predicted position (pixels) in the current frame, valid while n_tracked > 0
+	Rect blob;					// bounding box of the detected blob (pixels, empty if not found)
+	float position_est[2];		// estimated position (mm) at time_est
+	float velocity_est[2];		// estimated velocity (mm/s)
+	double time_est;			// time of the estimate (ticks)
+	int n_tracked;				// detections since the car was (re)acquired, 0 while it is lost
+	int n_coast;				// consecutive frames predicted without a detection
 	
 	// Default values
-	Car() : area_old(0) {}
+	Car() : area_old(0), orientation_new(0), time_est(0), n_tracked(0), n_coast(0) {}
 	
 	// Member function declarations
 	void px_to_mm(float scale, const float origin[]);
-	void new_to_old(void);
 	float speed(void);
 };
 
 // Member function definitions
 void Car::px_to_mm(float scale, const float origin[])
-// Convert position and velocity measurements from pixel values to mm from the coordinate system origin
+// Convert a position measurement from pixel values to mm from the coordinate system origin
 {
 	position_new[0] = scale*(position_new[0] - origin[0]);
 	position_new[1] = scale*(position_new[1] - origin[1]);
-	velocity_new[0] = scale*velocity_new[0];
-	velocity_new[1] = scale*velocity_new[1];
-	return;
-}
-
-void Car::new_to_old(void)
-// Update old variables with new data
-{
-	area_old = area_new;
-	position_old[0] = position_new[0];
-	position_old[1] = position_new[1];
-	velocity_old[0] = velocity_new[0];
-	velocity_old[1] = velocity_new[1];
-	orientation_old = orientation_new;
 	return;
 }
 
@@ -92,6 +185,7 @@ float Car::speed(void)
 }
 
 
+#ifndef NO_RASPICAM
 void cam_setup(raspicam::RaspiCam_Cv &Camera)
 // Read desired image width if provided and perform camera set up operations
 {
@@ -107,22 +201,38 @@ void cam_setup(raspicam::RaspiCam_Cv &Camera)
 	return;
 }
 
+void cam_setup_yuv(raspicam::RaspiCam &Camera)
+// Camera set up for I420 capture, with the same settings as cam_setup (converted from RaspiCam_Cv's 0-100 scales)
+{
+	Camera.setFormat(raspicam::RASPICAM_FORMAT_YUV420);
+	Camera.setWidth(IMG_WIDTH);
+	Camera.setHeight(IMG_HEIGHT);
+	Camera.setBrightness(IMG_BRIGHTNESS);
+	Camera.setContrast(IMG_CONTRAST*2 - 100);
+	Camera.setSaturation(IMG_SATURATION*2 - 100);
+	Camera.setISO(100 + IMG_GAIN*7);
+	Camera.setShutterSpeed(IMG_SHUTTER_SPEED*3300);	// microseconds
+	return;
+}
+#endif
+
 
-void do_config(vector<Car> &cars_all, int &crop, float origin[], float &scale, int &min_speed)
-// Configures algorithm data from config.txt file (which must be in the same directory as the main file)
-// Creates and populates Car and Obstacle structs
-// Reads and stores crop, origin and scale parameters
+bool do_config(vector<Car> &cars_all, Config &config, const char *path = "config.txt")
+// Configures algorithm data from config.txt file (which must be in the same directory as the main file), or from
+// another file in the same format
+// Creates and populates Car, CameraConfig and Obstacle structs
+// Reads and stores global parameters (crop, origin, scale etc.) in config
+// Returns false if the file could not be read
 {
 	// Open and check config file
-	ifstream f("config.txt");
+	ifstream f(path);
 	if (!f) {
-		cout << "Error: could not load config file: config.txt" << endl;
-		return;
+		cout << "Error: could not load config file: " << path << endl;
+		return false;
 	}
 	
 	string line, name, tmp, val;
 	Car car_dummy;
-	//Obstacle obst_dummy;
 	
 	while (getline(f, line)) {		// get the next line of the file
 		istringstream iss(line);	// send line to an istringstream
@@ -132,11 +242,61 @@ void do_config(vector<Car> &cars_all, int &crop, float origin[], float &scale, i
 		if (iss.fail() || tmp != "=" || name[0] == '#') continue;
 		
 		// Global parameters
-		if (name == "crop")			iss >> crop;
-		if (name == "origin_x")		iss >> origin[0];
-		if (name == "origin_y")		iss >> origin[1];
-		if (name == "scale")		iss >> scale;
-		if (name == "min_speed")	iss >> min_speed;
+		if (name == "crop")				iss >> config.crop;
+		if (name == "origin_x")			iss >> config.origin[0];
+		if (name == "origin_y")			iss >> config.origin[1];
+		if (name == "scale")			iss >> config.scale;
+		if (name == "min_speed")		iss >> config.min_speed;
+		if (name == "capture_format")	iss >> config.capture_format;
+		if (name == "decimation")		iss >> config.decimation;
+		if (name == "roi_size")			iss >> config.roi_size;
+		if (name == "roi_margin")		iss >> config.roi_margin;
+		if (name == "roi_reacquire")	iss >> config.roi_reacquire;
+		if (name == "assoc_gate")		iss >> config.assoc_gate;
+		if (name == "record")			iss >> config.record;
+		if (name == "replay_realtime")	iss >> config.replay_realtime;
+		if (name == "stats_interval")	iss >> config.stats_interval;
+		if (name == "track_alpha")		iss >> config.track_alpha;
+		if (name == "track_beta")		iss >> config.track_beta;
+		if (name == "track_coast")		iss >> config.track_coast;
+		if (name == "extrapolate_max")	iss >> config.extrapolate_max;
+		if (name == "publish_format")	iss >> config.publish_format;
+		if (name == "shm_name")			iss >> config.shm_name;
+		if (name == "target_fps")		iss >> config.target_fps;
+		if (name == "publish_backlog")	iss >> config.publish_backlog;
+		if (name == "detect_threads")	iss >> config.detect_threads;
+		if (name == "motion_tile")		iss >> config.motion_tile;
+		if (name == "motion_threshold")	iss >> config.motion_threshold;
+		if (name == "static_mask")		iss >> config.static_mask;
+		if (name == "static_frames")	iss >> config.static_frames;
+		if (name == "merge_distance")	iss >> config.merge_distance;
+		if (name == "merge_wait")		iss >> config.merge_wait;
+		if (name == "control_socket")	iss >> config.control_socket;	// "none" disables the socket
+		
+		// Cameras
+		if (name == "Camera") {
+			CameraConfig camera_dummy;
+			while (getline(f, line)) {
+				istringstream iss(line);
+				
+				iss >> name >> tmp >> val;
+				
+				if (iss.fail() || tmp != "=" || name[0] == '#') continue;	// invalid lines
+				
+				if (name == "source")	camera_dummy.source = val;
+				if (name == "crop")		camera_dummy.crop = stoi(val, nullptr);
+				if (name == "origin_x")	camera_dummy.origin[0] = stof(val, nullptr);
+				if (name == "origin_y")	camera_dummy.origin[1] = stof(val, nullptr);
+				if (name == "scale")	camera_dummy.scale = stof(val, nullptr);
+				if (name == "record")	camera_dummy.record = val;
+				if (name == "static_mask")	camera_dummy.static_mask = val;
+				
+				if (val == "end") {					// signifies end of camera config parameters
+					config.cameras.push_back(camera_dummy);
+					break;							// exit camera config while loop
+				}
+			}
+		}
 		
 		// Cars
 		// If dealing with a car, enter a second while loop to populate a dummy struct which is then pushed to the cars_all vector
@@ -156,26 +316,55 @@ void do_config(vector<Car> &cars_all, int &crop, float origin[], float &scale, i
 				if (name == "size_max")	car_dummy.size_max = stoi(val, nullptr);
 				
 				if (val == "end") {					// signifies end of car config parameters
-					cars_all.push_back(car_dummy);	// store cnewly configured car in cars_all vector
+					if (cars_all.size() < MAX_CARS) {
+						cars_all.push_back(car_dummy);	// store cnewly configured car in cars_all vector
+					} else {
+						cout << "ERROR: at most " << MAX_CARS << " cars are supported, ignoring " << car_dummy.name << " car" << endl;
+					}
 					break;							// exit car config while loop
 				}
 			}
 		}
 		
 		// Obstacles
-		// if (name == "Obstacles") {
-			// while (getline(f, line)) {
-				// istringstream iss(line);
-				// iss >> name >> tmp >> val;
+		// Each "point = x y" line adds a vertex of the obstacle's polygon (mm in the world frame)
+		if (name == "Obstacle") {
+			Obstacle obstacle_dummy;
+			while (getline(f, line)) {
+				istringstream iss(line);
 				
-				// if (iss.fail() || tmp != "=" || name[0] == '#') continue;	// invalid lines
+				iss >> name >> tmp >> val;
+				
+				if (iss.fail() || tmp != "=" || name[0] == '#') continue;	// invalid lines
 				
-				// TBC
+				if (name == "name")		obstacle_dummy.name = val;
+				if (name == "point") {
+					float y;
+					if (iss >> y) {
+						obstacle_dummy.points.push_back(Point2f(stof(val, nullptr), y));
+					} else {
+						cout << "ERROR: obstacle points are \"point = x y\", ignoring \"" << line << "\"" << endl;
+					}
+				}
 				
-				// if (val == "end")	break;	// signifies end of car config parameters
-			// }
-		// }
+				if (val == "end") {					// signifies end of obstacle config parameters
+					if (obstacle_dummy.points.size() >= 3) {
+						config.obstacles.push_back(obstacle_dummy);
+					} else {
+						cout << "ERROR: obstacle " << obstacle_dummy.name << " needs at least 3 points, ignoring it" << endl;
+					}
+					break;							// exit obstacle config while loop
+				}
+			}
+		}
+	}
+	
+	// Check parameters that would break detection
+	if (config.decimation < 1) {
+		cout << "ERROR: decimation must be at least 1, using full resolution" << endl;
+		config.decimation = 1;
 	}
+	return true;
 }
 
 
@@ -200,29 +389,78 @@ int state_output_mode (int output_mode)
 }
 
 
-void do_velocity(Car &car, double time_new, double time_old)
-// This function calculates the car's velocity based on two consecutive frames and
-// prints area, position and velocity outputs.
+void do_track(Car &car, const Config &config, double time_new)
+// Constant-velocity alpha-beta filter, run once per frame after find_car and px_to_mm
+// The measurement in position_new/area_new is blended with the prediction from the previous estimate, then
+// position_new, velocity_new and orientation_new are replaced by the new estimate. A car that is not detected is
+// predicted forward (coasted) for up to track_coast frames before it is reported lost.
 {
+	double time_inc = double (time_new - car.time_est) / double (cv::getTickFrequency());
+	float predicted[2] = {car.position_est[0] + car.velocity_est[0]*(float)time_inc,
+		car.position_est[1] + car.velocity_est[1]*(float)time_inc};
+	
 	if (car.area_new < 0) {
-		// Car not found in current frame, report zero velocity
-		car.velocity_new[0] = 0.0;
-		car.velocity_new[1] = 0.0;
-	} else if (car.area_old < 1) {
-		// No old data (but current data is acceptable), report zero velocity
-		car.velocity_new[0] = 0.0;
-		car.velocity_new[1] = 0.0;
+		if (car.n_tracked > 0 && car.n_coast < config.track_coast) {
+			// Car not found in current frame, coast on the prediction (and keep reporting the last measured area)
+			car.n_coast++;
+			car.position_est[0] = predicted[0];
+			car.position_est[1] = predicted[1];
+			car.area_new = car.area_old;
+		} else {
+			// Car lost, report zero velocity and orientation (as before tracking, a stale heading is not reported)
+			car.n_tracked = 0;
+			car.n_coast = 0;
+			car.velocity_new[0] = 0.0;
+			car.velocity_new[1] = 0.0;
+			car.orientation_new = 0;
+			return;
+		}
+	} else if (car.n_tracked == 0 || time_inc <= 0) {
+		// (Re)acquired, start from the measurement with zero velocity
+		car.n_tracked = 1;
+		car.n_coast = 0;
+		car.position_est[0] = car.position_new[0];
+		car.position_est[1] = car.position_new[1];
+		car.velocity_est[0] = 0.0;
+		car.velocity_est[1] = 0.0;
+		car.area_old = car.area_new;
 	} else {
-		double time_inc = double (time_new - time_old) / double (cv::getTickFrequency());
-		car.velocity_new[0] = (car.position_new[0] - car.position_old[0])/time_inc;
-		car.velocity_new[1] = (car.position_new[1] - car.position_old[1])/time_inc;
+		for (int i = 0; i < 2; i++) {
+			float residual = car.position_new[i] - predicted[i];
+			car.position_est[i] = predicted[i] + config.track_alpha*residual;
+			if (car.n_tracked == 1) {
+				// Second detection, use the raw two-frame velocity (the zero starting velocity was only a guess)
+				car.velocity_est[i] = residual/time_inc;
+			} else {
+				car.velocity_est[i] += config.track_beta*residual/time_inc;
+			}
+		}
+		car.n_tracked++;
+		car.n_coast = 0;
+		car.area_old = car.area_new;
+	}
+	car.time_est = time_new;
+	
+	// Report the estimate
+	car.position_new[0] = car.position_est[0];
+	car.position_new[1] = car.position_est[1];
+	car.velocity_new[0] = car.velocity_est[0];
+	car.velocity_new[1] = car.velocity_est[1];
+	
+	// Orientation from the direction of travel, held while the car is too slow for it to be meaningful
+	if (car.speed() > config.min_speed) {
+		car.orientation_new = (int)(90 - 180/M_PI*atan2(car.velocity_new[1], car.velocity_new[0]));
+		if (car.orientation_new < 0) {
+			car.orientation_new = 360 + car.orientation_new;
+		}
 	}
 	return;
 }
 
 
-void do_outputs(const vector<Car> cars_all, int frame, int output_mode, double time_new, double time_start)
-// Save desired log items. At present only has the capability to save images - the source image and optionally the masks as well.
+void do_outputs(const vector<Car> &cars_all, int frame, int output_mode, double time_new, double time_start)
+// Print console outputs for the current frame
+// Note: the csv log is written by Logger (see logger.hpp) so that file I/O stays off the tracking threads
 {
 	if (output_mode == 1 || output_mode > 2) {
 		// Print console output
@@ -234,7 +472,10 @@ void do_outputs(const vector<Car> cars_all, int frame, int output_mode, double t
 				// Car not found in current frame
 				cout<<"WARNING: "<< cars_all[i].name <<" car not detected"<<endl;
 				continue;
-			} else if (cars_all[i].area_old < 1) {
+			} else if (cars_all[i].n_coast > 0) {
+				// Car not found in current frame, but its position is predicted
+				cout<<"WARNING: "<< cars_all[i].name <<" car not detected, predicted for "<< cars_all[i].n_coast <<" frames"<<endl;
+			} else if (cars_all[i].n_tracked == 1) {
 				// No old data (but current data is acceptable)
 				cout<<"WARNING: previous instant has no data ("<< cars_all[i].name <<" car)"<<endl;
 			}	
@@ -246,103 +487,8 @@ void do_outputs(const vector<Car> cars_all, int frame, int output_mode, double t
 		}
 	}
 	
-	// Save csv file (log.csv)
-	if (output_mode > 1) {
-		// Open file
-		FILE * log_csv;
-		log_csv = fopen("log.csv","a");	// append mode
-		fprintf(log_csv, "%7.3f,", (time_new - time_start)/(cv::getTickFrequency()));	// time in seconds since program start
-		
-		// Add data for each car
-		for (int i = 0; i < cars_all.size(); i++) {
-			fprintf(log_csv, "%6.1f,", cars_all[i].area_new);
-			fprintf(log_csv, "%6.1f,", cars_all[i].position_new[0]);
-			fprintf(log_csv, "%6.1f,", cars_all[i].position_new[1]);
-			fprintf(log_csv, "%6.1f,", cars_all[i].velocity_new[0]);
-			fprintf(log_csv, "%6.1f,", cars_all[i].velocity_new[1]);
-			fprintf(log_csv, "%i,", cars_all[i].orientation_new);
-		}
-		fprintf(log_csv, "\n");
-		fclose(log_csv);
-	}
-	
 	return;
 }
 
 
-void do_json (vector<Car> cars_all, int sock, int output_mode, double time_new)
-// This function performs the task of saving the most recent data to the JSON output file
-// Note: the "append" method is used throughout because it has been shown to be one of the fastest string writing algorithms
-{
-	// Create JSON string
-	string json = "{";
-	
-	// RB - Add escaped quotes around time
-	json.append("\"time\":");
-	//int time_now = (int) round(1000*time_new/(cv::getTickFrequency()));		// current system time in milliseconds
-	
-	// RB trying a more python-compatible method to get time - unix time in milliseconds
-	struct timeval tp;
-	gettimeofday(&tp, NULL);
-	unsigned long long time_now = (unsigned long long)(tp.tv_sec) * 1000 + (unsigned long long)(tp.tv_usec) / 1000;
-	json.append(std::to_string(time_now));
-	
-	json.reserve(cars_all.size()*100);		// reserve memory for the json string (increases efficiency)
-	//int not_first = 0;						// begin at the "not not first" (i.e. first) car
-
-	for (int i = 0; i < cars_all.size(); i++) {
-
-		// If car was found, append its data to the json string
-		if (cars_all[i].area_new > 0) {
-
-			json.append(",");
-
-			//if (not_first) {
-				// Pre-pend car data with a comma (the key:value delimiter) except for first car
-				//json.append(",");
-			//}
-			json.append("\"");					// leading quote for MAC address						
-			json.append(cars_all[i].mac_add);	// MAC address
-			json.append("\":[");				// end quote for MAC address, colon for key:value pairs, opening bracket for data array
-			json.append("1");					// object type: 1 for cars
-			json.append(",");
-			json.append(std::to_string((int)round(cars_all[i].position_new[0])));	// x-position
-			json.append(",");
-			json.append(std::to_string((int)round(cars_all[i].position_new[1])));	// y-position
-			json.append(",");
-			json.append(std::to_string((int)round(cars_all[i].velocity_new[0])));	// x-velocity
-			json.append(",");
-			json.append(std::to_string((int)round(cars_all[i].velocity_new[1])));	// y-velocity
-			json.append(",");
-			json.append(std::to_string((int)round(cars_all[i].orientation_new)));	// orientation
-			json.append(",");
-			json.append("0");		// spare
-			json.append(",");
-			json.append("0");		// spare
-			json.append("]");		// closing array bracket and key:value comma delimiter
-			
-			//if (!not_first) {
-				// Set not_first to 1 for subsequent loops
-				//not_first = 1;
-			//}
-		}
-	}
-	json.append("}");
-	
-	if (output_mode == 4) {
-		// Debug mode - do not send output, do print JSON to console
-		cout<< json <<endl;
-	} else {
-		// Send JSON string to server via socket, do not print to console
-		if(send(sock, json.c_str(), json.size(), 0) < 0) {
-			cout<< "Send failed" <<endl;
-			return;
-		}
-	}
-	
-	return;
-}
-
-
-
 #endif
\ No newline at end of file
@@ -0,0 +1,332 @@
+// Header include guard
+#ifndef CONTROL_H	// if control.h has not been included, include it, otherwise do not
+#define CONTROL_H	// see end of file for corresponding #endif
+
+// General includes
+#include <iostream>		// cout
+#include <stdio.h>		// FILE, fdopen
+#include <string.h>		// strncpy
+#include <signal.h>		// sig_atomic_t
+#include <unistd.h>		// close, unlink
+#include <poll.h>		// poll
+#include <sys/stat.h>	// stat
+#include <sys/socket.h>	// socket
+#include <sys/time.h>	// timeval
+#include <sys/un.h>		// sockaddr_un
+#include <atomic>		// atomic
+#include <thread>		// thread
+#include <functional>	// function
+
+#include "common.hpp"	// common definitions
+
+// Namespaces
+using namespace std;
+
+// Control definitions:
+#define CONTROL_POLL_MS		500		// how often the control thread checks signals and config.txt when idle (ms)
+#define CONTROL_TIMEOUT_S	1		// longest time a client may take to send its command (s)
+#define CONTROL_LINE		256		// longest command accepted
+
+
+// Signal requests (SIGHUP reloads config.txt, SIGINT/SIGTERM stop the tracker cleanly)
+volatile sig_atomic_t reload_requested = 0;
+volatile sig_atomic_t exit_requested = 0;
+
+void on_reload_signal(int sig)
+// Signal handler, the control thread checks reload_requested
+{
+	reload_requested = 1;
+	return;
+}
+
+void on_exit_signal(int sig)
+// Signal handler, the control thread checks exit_requested
+{
+	exit_requested = 1;
+	return;
+}
+
+
+// Parameter set built from a reloaded config.txt
+// A Tuning is prepared by the control thread (parsing and lookup table building are kept off the hot path) and
+// handed to each stage through an atomic pointer; the stage swaps it in between frames.
+struct Tuning {
+	Config config;				// reloaded global parameters
+	vector<Car> cars_all;		// reloaded car parameters (hue, delta and size range)
+	vector<uchar> lut;			// lookup table for the stage's frame format (empty for stages that do not classify)
+	Tuning *next;				// next on a RetiredTunings list
+
+	Tuning() : next(NULL) {}
+};
+
+
+// Parameter sets a stage has swapped out, waiting to be freed by the control thread
+// Freeing a Tuning (its cars, config strings and lookup table) is kept off the hot path as well: the stage only pushes
+// it onto the list (lock-free, however many reloads arrive between frames) and the control thread frees the whole list
+// before handing over the next Tuning.
+struct RetiredTunings {
+	atomic<Tuning *> head;		// most recently retired (NULL if none)
+
+	RetiredTunings() : head(NULL) {}
+
+	void retire(Tuning *t)
+	// Add a swapped out Tuning (stage thread)
+	{
+		t->next = head.load(memory_order_relaxed);
+		while (!head.compare_exchange_weak(t->next, t, memory_order_release, memory_order_relaxed)) {}
+		return;
+	}
+
+	void free_all(void)
+	// Free every retired Tuning (control thread, or once the stage has finished)
+	{
+		Tuning *t = head.exchange(NULL, memory_order_acquire);
+		while (t != NULL) {
+			Tuning *next = t->next;
+			delete t;
+			t = next;
+		}
+		return;
+	}
+
+	~RetiredTunings() {
+		free_all();
+	}
+};
+
+
+bool check_tuning(const vector<Car> &cars_all, const Config &config, const vector<Car> &tuned_cars, const Config &tuned)
+// Check a reloaded config.txt can be applied without restarting, returns false if it cannot
+// Cars may be retuned but not added, removed or renamed. Changes to parameters that size buffers or open resources
+// are reported and ignored.
+{
+	if (tuned_cars.size() != cars_all.size()) {
+		cout << "Error: config reload changes the number of cars, restart to apply it" << endl;
+		return false;
+	}
+	for (int i = 0; i < cars_all.size(); i++) {
+		if (tuned_cars[i].name != cars_all[i].name || tuned_cars[i].mac_add != cars_all[i].mac_add) {
+			cout << "Error: config reload changes car " << cars_all[i].name << ", restart to apply it" << endl;
+			return false;
+		}
+	}
+	if (tuned.crop != config.crop || tuned.decimation != config.decimation || tuned.capture_format != config.capture_format
+			|| tuned.cameras.size() != config.cameras.size() || tuned.publish_format != config.publish_format
+			|| tuned.shm_name != config.shm_name || tuned.control_socket != config.control_socket
+			|| tuned.detect_threads != config.detect_threads || tuned.static_mask != config.static_mask
+			|| tuned.obstacles.size() != config.obstacles.size()) {
+		cout << "WARNING: crop, decimation, formats, cameras, shm_name, control_socket, detect_threads, static_mask and obstacles are only read at start up" << endl;
+	}
+	return true;
+}
+
+
+void do_retune(vector<Car> &cars_all, Config &config, const Tuning &tuning)
+// Apply reloaded parameters between frames, keeping each car's tracking state and the start-up only parameters
+{
+	for (int i = 0; i < cars_all.size(); i++) {
+		cars_all[i].hue = tuning.cars_all[i].hue;
+		cars_all[i].delta = tuning.cars_all[i].delta;
+		cars_all[i].size_min = tuning.cars_all[i].size_min;
+		cars_all[i].size_max = tuning.cars_all[i].size_max;
+	}
+	const Config &tuned = tuning.config;
+	config.min_speed = tuned.min_speed;
+	config.roi_size = tuned.roi_size;
+	config.roi_margin = tuned.roi_margin;
+	config.roi_reacquire = tuned.roi_reacquire;
+	config.assoc_gate = tuned.assoc_gate;
+	config.stats_interval = tuned.stats_interval;
+	config.track_alpha = tuned.track_alpha;
+	config.track_beta = tuned.track_beta;
+	config.track_coast = tuned.track_coast;
+	config.extrapolate_max = tuned.extrapolate_max;
+	config.merge_distance = tuned.merge_distance;
+	config.merge_wait = tuned.merge_wait;
+	config.target_fps = tuned.target_fps;
+	config.publish_backlog = tuned.publish_backlog;
+	config.static_frames = tuned.static_frames;
+	return;
+}
+
+
+void do_reset_tracks(vector<Car> &cars_all)
+// Forget every car's estimate (after tracking has been paused the old estimates are too stale to predict from)
+{
+	for (int i = 0; i < cars_all.size(); i++) {
+		cars_all[i].n_tracked = 0;
+		cars_all[i].n_coast = 0;
+	}
+	return;
+}
+
+
+// Control server
+// A thread listening on a local (Unix domain) stream socket for one-line commands, e.g.
+//   echo stats | socat - UNIX-CONNECT:/tmp/shmo.sock
+// start / stop		resume or pause tracking (the cameras keep running, so resuming needs no warm up)
+// mode <0-3>		change the output mode
+// stats			latency statistics so far
+// reload			reload config.txt (as on SIGHUP or when the file changes)
+// calibrate		calibrate each camera's static mask from its next static_frames frames (the arena must be empty)
+// quit				stop the tracker
+// The thread only sets flags and builds new parameter sets; the pipeline stages pick them up between frames.
+struct Control {
+	atomic<bool> quit;			// set when the tracker should stop
+	atomic<bool> paused;		// set while tracking is stopped
+	atomic<int> output_mode;	// output mode requested
+	function<void(FILE *)> report;	// writes the current statistics
+	function<bool(void)> reload;	// reloads config.txt and hands the new parameters to each stage
+	function<void(void)> calibrate;	// asks each camera to calibrate its static mask
+	int listen_fd;				// control socket (-1 if not open)
+	string path;				// control socket path
+	thread server;
+
+	Control() : quit(false), paused(false), output_mode(0), listen_fd(-1) {}
+
+	bool open_control(const string &socket_path, int mode)
+	// Open the control socket ("none" for no socket) and start the control thread, returns false if the socket could not
+	// be opened (signals and config.txt changes are still handled)
+	{
+		output_mode = mode;
+		path = socket_path;
+		bool ok = true;
+		if (path != "none") {
+			struct sockaddr_un addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sun_family = AF_UNIX;
+			strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+			unlink(path.c_str());	// left behind by a tracker that did not exit cleanly
+			listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 4) != 0) {
+				cout << "WARNING: could not open control socket " << path << ", control is by signals only" << endl;
+				if (listen_fd >= 0) close(listen_fd);
+				listen_fd = -1;
+				ok = false;
+			}
+		}
+		signal(SIGHUP, on_reload_signal);
+		signal(SIGINT, on_exit_signal);
+		signal(SIGTERM, on_exit_signal);
+		server = thread(&Control::serve, this);
+		return ok;
+	}
+
+	static time_t config_mtime(void)
+	// Modification time of config.txt (0 if it cannot be read)
+	{
+		struct stat st;
+		return stat("config.txt", &st) == 0 ? st.st_mtime : 0;
+	}
+
+	void serve(void)
+	// Control thread: answer commands, and reload config.txt on SIGHUP or when it changes
+	{
+		time_t mtime = config_mtime();
+		while (!quit.load()) {
+			if (listen_fd >= 0) {
+				struct pollfd pfd = {listen_fd, POLLIN, 0};
+				if (poll(&pfd, 1, CONTROL_POLL_MS) > 0) handle_client();
+			} else {
+				usleep(CONTROL_POLL_MS*1000);
+			}
+			if (exit_requested) {
+				quit = true;
+			}
+			time_t t = config_mtime();
+			if (reload_requested || (t != mtime && t != 0)) {
+				reload_requested = 0;
+				mtime = t;
+				do_reload();
+			}
+		}
+		return;
+	}
+
+	bool do_reload(void)
+	// Reload config.txt through the reload callback
+	{
+		bool ok = reload && reload();
+		cout << (ok ? "Reloaded config.txt" : "Error: config.txt not reloaded") << endl;
+		return ok;
+	}
+
+	void handle_client(void)
+	// Read one command from a new connection and reply to it
+	{
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) return;
+		struct timeval timeout = {CONTROL_TIMEOUT_S, 0};
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		char line[CONTROL_LINE];
+		int n = 0;
+		while (n < CONTROL_LINE - 1) {
+			ssize_t got = recv(fd, line + n, CONTROL_LINE - 1 - n, 0);
+			if (got <= 0) break;
+			n += got;
+			if (memchr(line, '\n', n) != NULL) break;
+		}
+		line[n] = '\0';
+		FILE *out = fdopen(fd, "w");
+		if (out == NULL) {
+			close(fd);
+			return;
+		}
+		command(line, out);
+		fclose(out);	// also closes fd
+		return;
+	}
+
+	void command(const char *line, FILE *out)
+	// Carry out one command
+	{
+		char name[CONTROL_LINE];
+		int mode;
+		if (sscanf(line, "%255s", name) != 1) {
+			fprintf(out, "Error: no command\n");
+		} else if (strcmp(name, "start") == 0) {
+			paused = false;
+			fprintf(out, "OK tracking\n");
+		} else if (strcmp(name, "stop") == 0) {
+			paused = true;
+			fprintf(out, "OK paused\n");
+		} else if (strcmp(name, "mode") == 0) {
+			if (sscanf(line, "%*s %d", &mode) == 1 && mode >= 0 && mode <= 3) {
+				output_mode = mode;
+				fprintf(out, "OK mode %d\n", mode);
+			} else {
+				fprintf(out, "Error: mode must be 0-3 (debug mode can only be chosen at start up)\n");
+			}
+		} else if (strcmp(name, "stats") == 0) {
+			if (report) report(out);
+		} else if (strcmp(name, "reload") == 0) {
+			fprintf(out, do_reload() ? "OK reloaded\n" : "Error: config.txt not reloaded\n");
+		} else if (strcmp(name, "calibrate") == 0) {
+			if (calibrate) calibrate();
+			fprintf(out, "OK calibrating the static mask (the arena must be empty)\n");
+		} else if (strcmp(name, "quit") == 0) {
+			quit = true;
+			fprintf(out, "OK quitting\n");
+		} else {
+			fprintf(out, "Error: unknown command %s (start, stop, mode <n>, stats, reload, calibrate or quit)\n", name);
+		}
+		return;
+	}
+
+	void close_control(void)
+	// Stop the control thread and remove the socket
+	{
+		quit = true;
+		if (server.joinable()) server.join();
+		if (listen_fd >= 0) {
+			close(listen_fd);
+			unlink(path.c_str());
+			listen_fd = -1;
+		}
+		return;
+	}
+};
+
+
+
+#endif
@@ -0,0 +1,168 @@
+// Stand-in for the master controller: receives the tracker's telemetry (see publish_format.hpp) and reports how stale
+// each message is on arrival and which frames never arrived, so latency can be measured on any Linux machine
+// Usage: ./controller [report every n messages (default 300)] [port (default 1520)]
+// Start it before the tracker, on the same machine (capture times are on the tracker's monotonic clock)
+
+// General includes
+#include <stdio.h>		// printf
+#include <stdlib.h>		// atoi, strtoull
+#include <string.h>		// memcpy, memchr, strstr
+#include <unistd.h>		// close
+#include <vector>		// vector
+#include <algorithm>	// sort
+
+// Socket/comms related includes
+#include <sys/socket.h>		// socket
+#include <netinet/in.h>		// sockaddr_in
+#include <arpa/inet.h>		// htons
+
+#include "publish_format.hpp"	// telemetry message layouts
+
+// Namespaces
+using namespace std;
+
+// Controller definitions:
+#define CTRL_BUFFER			65536		// bytes of the stream buffered while splitting it into messages
+
+
+// Latency and sequence gap statistics over a number of messages
+struct Report {
+	vector<uint64_t> latency;	// capture to receive time of each message (us)
+	long n_messages;			// messages received
+	long n_missing;				// frames whose sequence numbers were skipped (dropped or not sent by the tracker)
+	long n_gaps;				// places where the sequence jumped
+	long n_reordered;			// messages whose sequence number was not above the previous one
+
+	Report() : n_messages(0), n_missing(0), n_gaps(0), n_reordered(0) {}
+
+	void print(const char *label)
+	// Write one line: message count, latency p50, p99 and max (ms) and sequence gaps
+	{
+		printf("%-8s %7ld msgs", label, n_messages);
+		if (!latency.empty()) {
+			sort(latency.begin(), latency.end());
+			printf("  latency p50=%8.3f ms  p99=%8.3f ms  max=%8.3f ms", latency[latency.size()/2]/1e3,
+				latency[(latency.size() - 1)*99/100]/1e3, latency.back()/1e3);
+		}
+		printf("  missing=%ld (%ld gaps)", n_missing, n_gaps);
+		if (n_reordered > 0) printf("  out of order=%ld", n_reordered);
+		printf("\n");
+		fflush(stdout);
+		return;
+	}
+};
+
+
+bool parse_json(const char *line, long *seq, uint64_t *capture)
+// Read the sequence number and capture time from a JSON message, returns false if either is missing
+{
+	const char *p = strstr(line, "\"seq\":");
+	const char *q = strstr(line, "\"capture\":");
+	if (p == NULL || q == NULL) return false;
+	*seq = strtol(p + 6, NULL, 10);
+	*capture = strtoull(q + 10, NULL, 10);
+	return true;
+}
+
+
+int main(int argc, char **argv)
+{
+	int interval = argc > 1 ? atoi(argv[1]) : 300;
+	int port = argc > 2 ? atoi(argv[2]) : PUB_PORT;
+
+	// Listen for the tracker
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 1) != 0) {
+		printf("Error: could not listen on port %d\n", port);
+		return 1;
+	}
+	printf("Listening on port %d\n", port);
+
+	// One tracker session per connection
+	static char buffer[CTRL_BUFFER];
+	while (true) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) continue;
+		printf("Tracker connected\n");
+		Report total, recent;
+		long seq_last = -1;
+		size_t n_buffered = 0;
+		bool ok = true;
+		while (ok) {
+			ssize_t got = recv(fd, buffer + n_buffered, CTRL_BUFFER - n_buffered, 0);
+			if (got <= 0) break;
+			uint64_t time_received = pub_clock_us();
+			n_buffered += got;
+
+			// Split the stream into messages (JSON lines or length-prefixed binary)
+			size_t start = 0;
+			while (start < n_buffered) {
+				long seq;
+				uint64_t capture;
+				size_t length;
+				if (buffer[start] == '{') {
+					char *end = (char *)memchr(buffer + start, '\n', n_buffered - start);
+					if (end == NULL) break;
+					*end = '\0';
+					length = end - (buffer + start) + 1;
+					if (!parse_json(buffer + start, &seq, &capture)) {
+						printf("Error: JSON message without seq or capture (tracker older than this controller?)\n");
+						ok = false;
+						break;
+					}
+				} else {
+					PubHeader header;
+					if (n_buffered - start < sizeof(header)) break;
+					memcpy(&header, buffer + start, sizeof(header));
+					if (header.magic != PUB_MAGIC || header.version != PUB_VERSION || header.length < sizeof(header)
+							|| header.length > CTRL_BUFFER) {
+						printf("Error: not a telemetry message of version %d\n", PUB_VERSION);
+						ok = false;
+						break;
+					}
+					if (n_buffered - start < header.length) break;
+					length = header.length;
+					seq = header.seq;
+					capture = header.capture;
+				}
+				start += length;
+
+				// Staleness on arrival and sequence gaps
+				Report *reports[2] = {&total, &recent};
+				for (int i = 0; i < 2; i++) {
+					Report &r = *reports[i];
+					r.n_messages++;
+					if (capture > 0 && capture <= time_received) r.latency.push_back(time_received - capture);
+					if (seq_last >= 0 && seq > seq_last + 1) {
+						r.n_gaps++;
+						r.n_missing += seq - seq_last - 1;
+					} else if (seq_last >= 0 && seq <= seq_last) {
+						r.n_reordered++;
+					}
+				}
+				if (seq > seq_last) seq_last = seq;
+				if (interval > 0 && recent.n_messages >= interval) {
+					recent.print("recent");
+					recent = Report();
+				}
+			}
+			memmove(buffer, buffer + start, n_buffered - start);
+			n_buffered -= start;
+			if (n_buffered == CTRL_BUFFER) {
+				printf("Error: message longer than %d bytes\n", CTRL_BUFFER);
+				ok = false;
+			}
+		}
+		close(fd);
+		printf("Tracker disconnected\n");
+		total.print("total");
+	}
+	return 0;
+}
@@ -0,0 +1,456 @@
+// Header include guard
+#ifndef FRAME_SOURCE_H	// if frame_source.h has not been included, include it, otherwise do not
+#define FRAME_SOURCE_H	// see end of file for corresponding #endif
+
+// General includes
+#include <iostream>		// cout
+#include <string>		// string
+#include <stdint.h>		// uint32_t, uint64_t
+#include <fcntl.h>		// open
+#include <unistd.h>		// sleep, usleep, write, close
+#include <sys/mman.h>	// mmap, madvise
+#include <sys/stat.h>	// fstat
+
+// OpenCV and camera includes
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "common.hpp"	// common definitions (cam_setup)
+#include "pipeline.hpp"	// Frame
+#include "stats.hpp"	// stage timing
+#include "publish_format.hpp"	// pub_clock_us
+
+// Namespaces
+using namespace std;
+using namespace cv;
+
+// Frame archive definitions:
+#define ARCHIVE_MAGIC		0x4d524653	// "SFRM" (little-endian), identifies a raw frame archive
+#define ARCHIVE_VERSION		1
+#define REPLAY_FPS			30			// frame rate assumed for recordings without timestamps (e.g. image sequences)
+
+
+// Raw frame archive header
+// An archive is one ArchiveHeader followed by n_frames records, each a double capture time (seconds since the first
+// frame) immediately followed by the frame's pixels (the rows of the frame's Mat, no padding). I420 frames are stored
+// with type CV_8UC1 and frame_bytes = width*height*3/2 (the Y plane followed by the U and V planes).
+struct ArchiveHeader {
+	uint32_t magic;				// ARCHIVE_MAGIC
+	uint32_t version;			// ARCHIVE_VERSION
+	uint32_t width;				// frame width (pixels)
+	uint32_t height;			// frame height (pixels)
+	uint32_t type;				// OpenCV type of each frame (CV_8UC3 for BGR, CV_8UC1 for I420)
+	uint32_t n_frames;			// number of frames in the archive
+	uint64_t frame_bytes;		// size of each frame's pixel data
+};
+
+
+// Frame source interface
+// Fills Frame structs for the capture stage. time is in cv::getTickCount() ticks; for recordings it is derived from the
+// recorded capture times (not from when the frame was read) so replays give the same velocities at any speed.
+// Frames are either BGR or I420; an I420 frame is one CV_8UC1 Mat of height*3/2 rows (OpenCV's layout: the Y plane,
+// then the quarter-size U and V planes).
+struct FrameSource {
+	Size size;					// frame dimensions, valid once open_source() has succeeded
+	int type;					// OpenCV type of each frame's Mat
+	bool i420;					// frames are I420 rather than BGR
+	Stats *stats;				// grab/retrieve timings are recorded here if set
+
+	FrameSource() : type(CV_8UC3), i420(false), stats(NULL) {}
+
+	Size image_size(void) const
+	// Dimensions of each frame's Mat
+	{
+		return i420 ? Size(size.width, size.height*3/2) : size;
+	}
+
+	void record_stage(int stage, double tick_start, double tick_end)
+	// Record a stage timing if statistics are being collected
+	{
+		if (stats != NULL) stats->record(stage, tick_start, tick_end);
+		return;
+	}
+
+	virtual ~FrameSource() {}
+	virtual bool open_source(void) = 0;		// prepare the source, returns false on failure
+	virtual bool read(Frame &frame) = 0;	// capture or load the next frame, returns false when there are no more
+	virtual void release(void) {}
+};
+
+
+// Replay pacing
+// Recorded sources either run as fast as possible or wait until each frame's recorded time has elapsed
+struct ReplayClock {
+	bool realtime;				// wait for the recorded time of each frame
+	double time_zero;			// tick count corresponding to the first recorded frame
+
+	ReplayClock() : realtime(false), time_zero(0) {}
+
+	double frame_time(double recorded)
+	// Convert a recorded time (seconds) to ticks, waiting for it if replaying at the original pace
+	{
+		if (time_zero == 0) time_zero = cv::getTickCount();
+		double ticks = time_zero + recorded*cv::getTickFrequency();
+		if (realtime) {
+			double wait = (ticks - cv::getTickCount())/cv::getTickFrequency();
+			if (wait > 0) usleep((useconds_t)(wait*1e6));
+		}
+		return ticks;
+	}
+};
+
+
+#ifndef NO_RASPICAM
+// Live Raspberry Pi camera
+struct CameraSource : FrameSource {
+	raspicam::RaspiCam_Cv Camera;
+
+	bool open_source(void)
+	{
+		cam_setup(Camera);
+		if (!Camera.open()) {
+			cerr<<"Error opening camera"<<endl;
+			return false;
+		}
+		sleep(2);	// sleep required to wait for camera to "warm up"
+
+		// Grab a test image to find frame dimensions
+		Mat src;
+		Camera.grab();
+		Camera.retrieve(src);
+		size = src.size();
+		type = src.type();
+		return true;
+	}
+
+	bool read(Frame &frame)
+	{
+		double tick = cv::getTickCount();
+		Camera.grab();
+		frame.time = cv::getTickCount();	// time image collected
+		frame.time_capture = pub_clock_us();
+		Camera.retrieve(frame.image);
+		record_stage(STAGE_GRAB, tick, frame.time);
+		record_stage(STAGE_RETRIEVE, frame.time, cv::getTickCount());
+		return true;
+	}
+
+	void release(void)
+	{
+		Camera.release();
+		return;
+	}
+};
+
+
+// Live Raspberry Pi camera delivering I420 (the camera's native format, so no colour conversion is done at all)
+struct CameraYuvSource : FrameSource {
+	raspicam::RaspiCam Camera;
+
+	CameraYuvSource() { i420 = true; type = CV_8UC1; }
+
+	bool open_source(void)
+	{
+		cam_setup_yuv(Camera);
+		if (!Camera.open()) {
+			cerr<<"Error opening camera"<<endl;
+			return false;
+		}
+		sleep(2);	// sleep required to wait for camera to "warm up"
+		size = Size(Camera.getWidth(), Camera.getHeight());
+		if (Camera.getImageTypeSize(raspicam::RASPICAM_FORMAT_YUV420) != (size_t)size.area()*3/2) {
+			cerr<<"Error: camera I420 frames are padded, use a width that is a multiple of 32 and a height that is a multiple of 16"<<endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool read(Frame &frame)
+	{
+		double tick = cv::getTickCount();
+		Camera.grab();
+		frame.time = cv::getTickCount();	// time image collected
+		frame.time_capture = pub_clock_us();
+		Camera.retrieve(frame.image.data, raspicam::RASPICAM_FORMAT_IGNORE);	// into the preallocated frame buffer
+		record_stage(STAGE_GRAB, tick, frame.time);
+		record_stage(STAGE_RETRIEVE, frame.time, cv::getTickCount());
+		return true;
+	}
+
+	void release(void)
+	{
+		Camera.release();
+		return;
+	}
+};
+#endif
+
+
+// Video file or image sequence (e.g. frames/%04d.png), read with OpenCV (and converted to I420 if requested)
+struct VideoSource : FrameSource {
+	string path;
+	VideoCapture capture;
+	ReplayClock clock;
+	long n_read;				// frames read so far
+	Mat bgr;					// decoded frame, when converting to I420
+
+	VideoSource(const string &p, bool realtime, bool yuv) : path(p), n_read(0) {
+		clock.realtime = realtime;
+		i420 = yuv;
+		type = yuv ? CV_8UC1 : CV_8UC3;
+	}
+
+	bool open_source(void)
+	{
+		if (!capture.open(path)) {
+			cerr<<"Error opening video: "<<path<<endl;
+			return false;
+		}
+		size = Size((int)capture.get(CV_CAP_PROP_FRAME_WIDTH), (int)capture.get(CV_CAP_PROP_FRAME_HEIGHT));
+		if (i420 && (size.width % 2 || size.height % 2)) {
+			cerr<<"Error: I420 needs even frame dimensions: "<<path<<endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool read(Frame &frame)
+	{
+		double tick = cv::getTickCount();
+		if (!capture.read(i420 ? bgr : frame.image)) return false;
+		if (i420) cvtColor(bgr, frame.image, COLOR_BGR2YUV_I420);
+		record_stage(STAGE_GRAB, tick, cv::getTickCount());
+
+		// Use the stream's timestamps where it has them, otherwise assume a constant frame rate
+		double recorded = capture.get(CV_CAP_PROP_POS_MSEC)/1000.0;
+		if (recorded <= 0 && n_read > 0) recorded = double (n_read) / REPLAY_FPS;
+		frame.time = clock.frame_time(recorded);
+		n_read++;
+		return true;
+	}
+
+	void release(void)
+	{
+		capture.release();
+		return;
+	}
+};
+
+
+// Raw frame archive (see ArchiveHeader), memory-mapped and handed to the pipeline without copying
+struct ArchiveSource : FrameSource {
+	string path;
+	ReplayClock clock;
+	uchar *map;					// mapped archive
+	size_t map_bytes;			// size of the mapping
+	ArchiveHeader header;
+	long n_read;				// frames read so far
+
+	ArchiveSource(const string &p, bool realtime) : path(p), map(NULL), map_bytes(0), n_read(0) { clock.realtime = realtime; }
+
+	bool open_source(void)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < sizeof(ArchiveHeader)) {
+			cerr<<"Error opening frame archive: "<<path<<endl;
+			if (fd >= 0) close(fd);
+			return false;
+		}
+		map_bytes = st.st_size;
+		void *p = mmap(NULL, map_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);	// the mapping stays valid
+		if (p == MAP_FAILED) {
+			cerr<<"Error mapping frame archive: "<<path<<endl;
+			return false;
+		}
+		map = (uchar *)p;
+		madvise(map, map_bytes, MADV_SEQUENTIAL);
+
+		// Check header
+		header = *(ArchiveHeader *)map;
+		if (header.magic != ARCHIVE_MAGIC || header.version != ARCHIVE_VERSION) {
+			cerr<<"Error: "<<path<<" is not a frame archive"<<endl;
+			return false;
+		}
+		size_t frames_available = (map_bytes - sizeof(ArchiveHeader))/(sizeof(double) + header.frame_bytes);
+		if (frames_available < header.n_frames) {
+			cout<<"WARNING: frame archive "<<path<<" is truncated, replaying "<<frames_available<<" of "<<header.n_frames<<" frames"<<endl;
+			header.n_frames = frames_available;
+		}
+		size = Size(header.width, header.height);
+		type = header.type;
+		i420 = type == CV_8UC1 && header.frame_bytes == (uint64_t)size.area()*3/2;
+		return true;
+	}
+
+	bool read(Frame &frame)
+	{
+		if (n_read >= header.n_frames) return false;
+		uchar *record = map + sizeof(ArchiveHeader) + n_read*(sizeof(double) + header.frame_bytes);
+
+		// Point the frame at the mapped pixels (no copy)
+		Size image = image_size();
+		frame.image = Mat(image.height, image.width, type, record + sizeof(double));
+		frame.time = clock.frame_time(*(double *)record);
+		n_read++;
+		return true;
+	}
+
+	void release(void)
+	{
+		if (map != NULL) munmap(map, map_bytes);
+		map = NULL;
+		return;
+	}
+};
+
+
+// Headerless I420 recording (e.g. from raspiyuv or raspivid -r): consecutive IMG_WIDTH x IMG_HEIGHT frames, replayed at
+// REPLAY_FPS. Memory-mapped and handed to the pipeline without copying.
+struct RawYuvSource : FrameSource {
+	string path;
+	ReplayClock clock;
+	uchar *map;					// mapped recording
+	size_t map_bytes;			// size of the mapping
+	long n_frames;				// frames in the recording
+	long n_read;				// frames read so far
+
+	RawYuvSource(const string &p, bool realtime) : path(p), map(NULL), map_bytes(0), n_frames(0), n_read(0) {
+		clock.realtime = realtime;
+		i420 = true;
+		type = CV_8UC1;
+		size = Size(IMG_WIDTH, IMG_HEIGHT);
+	}
+
+	bool open_source(void)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < size.area()*3/2) {
+			cerr<<"Error opening I420 recording: "<<path<<endl;
+			if (fd >= 0) close(fd);
+			return false;
+		}
+		map_bytes = st.st_size;
+		void *p = mmap(NULL, map_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);	// the mapping stays valid
+		if (p == MAP_FAILED) {
+			cerr<<"Error mapping I420 recording: "<<path<<endl;
+			return false;
+		}
+		map = (uchar *)p;
+		madvise(map, map_bytes, MADV_SEQUENTIAL);
+		n_frames = map_bytes/(size.area()*3/2);
+		return true;
+	}
+
+	bool read(Frame &frame)
+	{
+		if (n_read >= n_frames) return false;
+		Size image = image_size();
+		frame.image = Mat(image.height, image.width, type, map + n_read*image.area());
+		frame.time = clock.frame_time(double (n_read) / REPLAY_FPS);
+		n_read++;
+		return true;
+	}
+
+	void release(void)
+	{
+		if (map != NULL) munmap(map, map_bytes);
+		map = NULL;
+		return;
+	}
+};
+
+
+// Raw frame archive writer, used to record a session for later replay
+struct ArchiveWriter {
+	int fd;						// archive file (-1 if not recording)
+	ArchiveHeader header;
+	double time_first;			// tick count of the first recorded frame
+
+	ArchiveWriter() : fd(-1), time_first(0) {}
+
+	bool open_archive(const char *filename, Size size, int type, bool i420)
+	// Create the archive and write a provisional header (n_frames is filled in by close_archive)
+	{
+		fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			cout<<"Error: could not open frame archive: "<<filename<<endl;
+			return false;
+		}
+		Mat probe(1, 1, type);
+		header.magic = ARCHIVE_MAGIC;
+		header.version = ARCHIVE_VERSION;
+		header.width = size.width;
+		header.height = size.height;
+		header.type = type;
+		header.n_frames = 0;
+		header.frame_bytes = (uint64_t)size.area()*probe.elemSize()*(i420 ? 3 : 2)/2;
+		return write(fd, &header, sizeof(header)) == sizeof(header);
+	}
+
+	void record(const Frame &frame)
+	// Append one frame (synchronous, so only use when recording)
+	{
+		if (fd < 0) return;
+		if (header.n_frames == 0) time_first = frame.time;
+		double recorded = (frame.time - time_first)/cv::getTickFrequency();
+		bool ok = write(fd, &recorded, sizeof(recorded)) == sizeof(recorded);
+		size_t row_bytes = frame.image.cols*frame.image.elemSize();
+		for (int y = 0; y < frame.image.rows && ok; y++) {
+			ok = write(fd, frame.image.ptr<uchar>(y), row_bytes) == row_bytes;
+		}
+		if (!ok) {
+			cout<<"Error: could not write frame archive, recording stopped"<<endl;
+			close_archive();
+			return;
+		}
+		header.n_frames++;
+		return;
+	}
+
+	void close_archive(void)
+	// Write the final frame count and close the file
+	{
+		if (fd < 0) return;
+		if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+			cout<<"Error: could not finalise frame archive header"<<endl;
+		}
+		close(fd);
+		fd = -1;
+		cout<<"Recorded frames: "<<header.n_frames<<endl;
+		return;
+	}
+};
+
+
+FrameSource *make_source(const string &name, const Config &config)
+// Choose a frame source from its name: "camera" for the Pi camera, a file ending in .raw for a frame archive, .yuv or
+// .i420 for a headerless I420 recording, anything else is opened with OpenCV as a video file or image sequence
+// Live camera and video frames are delivered as I420 if config.capture_format is "i420" (recordings keep their format)
+{
+	bool i420 = config.capture_format == "i420";
+	if (name == "camera") {
+#ifndef NO_RASPICAM
+		if (i420) return new CameraYuvSource();
+		return new CameraSource();
+#else
+		cerr<<"Error: built without camera support (NO_RASPICAM), give a recording to replay instead"<<endl;
+		return NULL;
+#endif
+	}
+	if (name.size() > 4 && name.compare(name.size() - 4, 4, ".raw") == 0) {
+		return new ArchiveSource(name, config.replay_realtime);
+	}
+	if ((name.size() > 4 && name.compare(name.size() - 4, 4, ".yuv") == 0) ||
+		(name.size() > 5 && name.compare(name.size() - 5, 5, ".i420") == 0)) {
+		return new RawYuvSource(name, config.replay_realtime);
+	}
+	return new VideoSource(name, config.replay_realtime, i420);
+}
+
+
+
+#endif
@@ -0,0 +1,68 @@
+// Converts a binary trajectory log (log.bin, written by Logger in logger.hpp) to the csv layout read by basic_analysis.m
+// Usage: ./log2csv [input (default log.bin)] [output (default log.csv)]
+// The log is preallocated on disk and only trimmed when the tracker closes it, so a log left by a crash ends in
+// zero-filled records. Conversion stops at the first all-zero record (a real record never is: its areas are -1 or more
+// than size_min, and only the first frame has time 0).
+
+// General includes
+#include <iostream>		// cout
+#include <stdio.h>		// fopen, fread, fprintf
+#include <string.h>		// memcmp, memset
+
+#include "log_format.hpp"	// binary log file layout
+
+// Namespaces
+using namespace std;
+
+int main(int argc, char **argv)
+{
+	const char *in_name = argc > 1 ? argv[1] : "log.bin";
+	const char *out_name = argc > 2 ? argv[2] : "log.csv";
+
+	// Open and check binary log
+	FILE *log_bin = fopen(in_name, "rb");
+	if (log_bin == NULL) {
+		cout << "Error: could not open " << in_name << endl;
+		return 1;
+	}
+	LogHeader header;
+	if (fread(&header, sizeof(header), 1, log_bin) != 1 || header.magic != LOG_MAGIC) {
+		cout << "Error: " << in_name << " is not a binary trajectory log" << endl;
+		return 1;
+	}
+	if (header.version != LOG_VERSION || header.record_size != sizeof(LogRecord) || header.n_cars > LOG_MAX_CARS) {
+		cout << "Error: unsupported log version or record layout in " << in_name << endl;
+		return 1;
+	}
+
+	// Write csv header (one lot of headers for each car)
+	FILE *log_csv = fopen(out_name, "w");
+	if (log_csv == NULL) {
+		cout << "Error: could not open " << out_name << endl;
+		return 1;
+	}
+	log_csv_header(log_csv, header.n_cars);
+
+	// Write one row per record, formatted as the tracker used to write it
+	LogRecord record, zero;
+	memset(&zero, 0, sizeof(zero));
+	long n_records = 0, n_unused = 0;
+	while (fread(&record, sizeof(record), 1, log_bin) == 1) {
+		if (memcmp(&record, &zero, sizeof(record)) == 0) {
+			// Preallocated space the tracker never wrote (it did not close the log)
+			n_unused = 1;
+			while (fread(&record, sizeof(record), 1, log_bin) == 1) n_unused++;
+			break;
+		}
+		log_csv_row(log_csv, record, header.n_cars);
+		n_records++;
+	}
+	fclose(log_bin);
+	fclose(log_csv);
+
+	cout << "Converted " << n_records << " records from " << in_name << " to " << out_name << endl;
+	if (n_unused > 0) {
+		cout << "WARNING: " << in_name << " was not closed by the tracker, " << n_unused << " unused preallocated records skipped" << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,65 @@
+// Header include guard
+#ifndef LOG_FORMAT_H	// if log_format.h has not been included, include it, otherwise do not
+#define LOG_FORMAT_H	// see end of file for corresponding #endif
+
+// Binary trajectory log file layout, shared by the tracker (logger.hpp), log2csv.cpp and reanalyse.cpp
+// A file is one LogHeader followed by one LogRecord per logged frame
+
+// General includes
+#include <stdint.h>		// uint32_t
+#include <stdio.h>		// fprintf
+
+// Log format definitions:
+#define LOG_MAGIC			0x474f4c53	// "SLOG" (little-endian), identifies a binary trajectory log
+#define LOG_VERSION			1
+#define LOG_MAX_CARS		8			// cars stored in each record (must be at least MAX_CARS)
+#define LOG_FIELDS			6			// values stored per car: area, x, y, v_x, v_y, theta
+
+
+// Binary log file header (written once at the start of the file)
+struct LogHeader {
+	uint32_t magic;				// LOG_MAGIC
+	uint32_t version;			// LOG_VERSION
+	uint32_t n_cars;			// number of cars with data in each record
+	uint32_t record_size;		// sizeof(LogRecord)
+};
+
+
+// Binary log record (one per frame, fixed size so the file can be indexed and preallocated)
+struct LogRecord {
+	double time;							// time in seconds since program start
+	float cars[LOG_MAX_CARS][LOG_FIELDS];	// area, x, y, v_x, v_y, theta for each car (unused cars are zero)
+};
+
+
+inline void log_csv_header(FILE *f, int n_cars)
+// Write the csv header read by basic_analysis.m (one lot of headers for each car)
+{
+	fprintf(f, "time(s)");
+	for (int i = 0; i < n_cars; i++) {
+		fprintf(f, ",area,x,y,v_x,v_y,theta");
+	}
+	fprintf(f, "\n");
+	return;
+}
+
+
+inline void log_csv_row(FILE *f, const LogRecord &record, int n_cars)
+// Write one record as a csv row, formatted as the tracker used to write it
+{
+	fprintf(f, "%7.3f,", record.time);
+	for (int i = 0; i < n_cars; i++) {
+		fprintf(f, "%6.1f,", record.cars[i][0]);
+		fprintf(f, "%6.1f,", record.cars[i][1]);
+		fprintf(f, "%6.1f,", record.cars[i][2]);
+		fprintf(f, "%6.1f,", record.cars[i][3]);
+		fprintf(f, "%6.1f,", record.cars[i][4]);
+		fprintf(f, "%i,", (int)record.cars[i][5]);
+	}
+	fprintf(f, "\n");
+	return;
+}
+
+
+
+#endif
@@ -0,0 +1,147 @@
+// Header include guard
+#ifndef LOGGER_H	// if logger.h has not been included, include it, otherwise do not
+#define LOGGER_H	// see end of file for corresponding #endif
+
+// General includes
+#include <iostream>		// cout
+#include <thread>		// thread
+#include <string.h>		// memset
+#include <fcntl.h>		// open, posix_fallocate
+#include <unistd.h>		// write, lseek, ftruncate, close
+
+#include "common.hpp"	// common definitions
+#include "pipeline.hpp"	// channel between tracking and the log writer
+#include "log_format.hpp"	// binary log file layout
+
+// Namespaces
+using namespace std;
+
+static_assert(MAX_CARS <= LOG_MAX_CARS, "log records must have room for every car");
+
+// Logger definitions:
+#define LOG_QUEUE			256			// records that may wait for the writer thread
+#define LOG_BATCH			64			// records written to the file per write() call
+#define LOG_PREALLOC		108000		// records preallocated on disk when the log is opened (one hour at 30 fps)
+
+
+void do_record(LogRecord &record, const vector<Car> &cars_all, int n_cars, double time_new, double time_start)
+// Fill a log record with the current state of the first n_cars cars
+{
+	memset(&record, 0, sizeof(record));
+	record.time = (time_new - time_start)/(cv::getTickFrequency());		// time in seconds since program start
+	for (int i = 0; i < n_cars; i++) {
+		record.cars[i][0] = cars_all[i].area_new;
+		record.cars[i][1] = cars_all[i].position_new[0];
+		record.cars[i][2] = cars_all[i].position_new[1];
+		record.cars[i][3] = cars_all[i].velocity_new[0];
+		record.cars[i][4] = cars_all[i].velocity_new[1];
+		record.cars[i][5] = cars_all[i].orientation_new;
+	}
+	return;
+}
+
+
+// Asynchronous trajectory logger
+// Records are queued by the tracking loop and written to disk in batches by a background thread, so no file I/O or
+// formatting happens on the hot path. If the writer falls behind, the oldest queued records are dropped and counted.
+// Use log2csv to convert the file to the csv layout expected by basic_analysis.m.
+struct Logger {
+	Channel<LogRecord> queue;	// records waiting to be written
+	int fd;						// log file (-1 if not open)
+	int n_cars;					// number of cars being logged
+	long n_written;				// records written to the file
+	long n_failed;				// records lost to write errors
+	thread writer;				// background writer thread
+	vector<LogRecord> batch;	// records being written (allocated before the writer starts)
+
+	Logger() : queue(LOG_QUEUE), fd(-1), n_cars(0), n_written(0), n_failed(0) {}
+
+	bool open_log(const char *filename, int cars)
+	// Create the log file, write its header and start the writer thread
+	{
+		fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			cout << "Error: could not open log file: " << filename << endl;
+			return false;
+		}
+		n_cars = cars;
+
+		LogHeader header = {LOG_MAGIC, LOG_VERSION, (uint32_t)n_cars, sizeof(LogRecord)};
+		if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+			cout << "Error: could not write log file: " << filename << endl;
+			close(fd);
+			fd = -1;
+			return false;
+		}
+
+		// Reserve space up front so the file system does not have to find blocks while tracking
+		posix_fallocate(fd, 0, sizeof(LogHeader) + (off_t)LOG_PREALLOC*sizeof(LogRecord));
+
+		batch.resize(LOG_BATCH);
+
+		writer = thread(&Logger::write_loop, this);
+		return true;
+	}
+
+	void log(const vector<Car> &cars_all, double time_new, double time_start)
+	// Queue one record holding the current state of every car (never blocks)
+	{
+		if (fd < 0) return;
+		do_record(queue.write_slot(), cars_all, n_cars, time_new, time_start);
+		queue.push();
+		return;
+	}
+
+	void write_loop(void)
+	// Writer thread: copy queued records into a batch and write it whenever it is full or the queue runs dry
+	{
+		int n_batch = 0;
+		LogRecord *record;
+		while (true) {
+			record = queue.pop();
+			if (record != NULL) {
+				batch[n_batch++] = *record;
+				if (n_batch < LOG_BATCH) continue;
+			} else if (n_batch == 0) {
+				if (queue.closed.load(memory_order_acquire) && (record = queue.pop()) == NULL) break;
+				if (record != NULL) {
+					batch[n_batch++] = *record;
+				} else {
+					usleep(PIPE_WAIT_US);
+				}
+				continue;
+			}
+
+			// Write the batch
+			ssize_t n_bytes = write(fd, &batch[0], n_batch*sizeof(LogRecord));
+			if (n_bytes < 0) n_bytes = 0;
+			n_written += n_bytes/sizeof(LogRecord);
+			if (n_bytes != n_batch*sizeof(LogRecord)) {
+				// Short write: count the lost records and keep the file aligned to whole records
+				n_failed += n_batch - n_bytes/sizeof(LogRecord);
+				lseek(fd, sizeof(LogHeader) + (off_t)n_written*sizeof(LogRecord), SEEK_SET);
+			}
+			n_batch = 0;
+		}
+		return;
+	}
+
+	void close_log(void)
+	// Flush remaining records, trim the preallocated space and close the file
+	{
+		if (fd < 0) return;
+		queue.close();
+		writer.join();
+		if (ftruncate(fd, sizeof(LogHeader) + (off_t)n_written*sizeof(LogRecord)) != 0) {
+			cout << "Error: could not trim log file" << endl;
+		}
+		close(fd);
+		fd = -1;
+		cout << "Log records: " << n_written << " written, " << queue.dropped << " dropped, " << n_failed << " failed" << endl;
+		return;
+	}
+};
+
+
+
+#endif
@@ -0,0 +1,157 @@
+// Header include guard
+#ifndef MOTION_H	// if motion.h has not been included, include it, otherwise do not
+#define MOTION_H	// see end of file for corresponding #endif
+
+// General includes
+#include <vector>		// vector
+#include <stdlib.h>		// abs
+
+// OpenCV includes
+#include "opencv2/imgproc/imgproc.hpp"
+
+// Namespaces
+using namespace std;
+using namespace cv;
+
+// Motion gating definitions:
+#define MOTION_SAMPLE		4		// pixels between the samples compared in each direction (tiles are a multiple of this)
+
+
+// Per-tile change detection
+// The frame is split into square tiles, and each tile keeps a reference copy of a sparse grid of samples (green for
+// BGR frames, luma for I420) taken when it was last classified. A tile whose samples now differ from the reference by
+// more than the threshold is dirty and must be classified again; a clean tile's labels are still valid. Comparing
+// against the reference rather than the previous frame means slow changes still add up and mark the tile, e.g. a car
+// creeping between sample columns is picked up once it has moved MOTION_SAMPLE pixels.
+struct MotionGate {
+	int tile;					// tile side (pixels), 0 if gating is disabled
+	int threshold;				// largest sample difference treated as noise
+	int nx, ny;					// tiles across and down
+	Size size;					// frame size (pixels)
+	Mat reference;				// samples when each tile was last classified (one per MOTION_SAMPLE x MOTION_SAMPLE pixels)
+	vector<uchar> dirty;		// 1 for tiles whose labels are out of date
+	vector<uchar> fresh;		// 1 for tiles classified in the current frame
+	long n_tiles, n_classified;	// tiles checked and tiles classified (for reporting)
+
+	MotionGate() : tile(0), threshold(0), nx(0), ny(0), n_tiles(0), n_classified(0) {}
+
+	void open_gate(Size frame_size, int tile_size, int sample_threshold)
+	// Allocate the reference samples and tile flags, every tile starts dirty
+	{
+		tile = (tile_size + MOTION_SAMPLE - 1)/MOTION_SAMPLE*MOTION_SAMPLE;
+		threshold = sample_threshold;
+		size = frame_size;
+		nx = (size.width + tile - 1)/tile;
+		ny = (size.height + tile - 1)/tile;
+		reference = Mat::zeros((size.height + MOTION_SAMPLE - 1)/MOTION_SAMPLE, (size.width + MOTION_SAMPLE - 1)/MOTION_SAMPLE, CV_8UC1);
+		dirty.assign(nx*ny, 1);
+		fresh.assign(nx*ny, 0);
+		return;
+	}
+
+	void invalidate(void)
+	// Mark every tile dirty (e.g. when the lookup table changes)
+	{
+		dirty.assign(nx*ny, 1);
+		return;
+	}
+
+	static inline uchar sample(const Mat &src, bool i420, int x, int y)
+	// Value compared at pixel (x, y): green of a BGR frame, luma of an I420 frame
+	{
+		return i420 ? src.ptr<uchar>(y)[x] : src.ptr<uchar>(y)[3*x + 1];
+	}
+
+	void update(const Mat &src, bool i420)
+	// Compare every tile not already dirty with its reference samples
+	{
+		for (int ty = 0; ty < ny; ty++) {
+			for (int tx = 0; tx < nx; tx++) {
+				int t = ty*nx + tx;
+				fresh[t] = 0;
+				if (dirty[t]) continue;
+				int x_end = min((tx + 1)*tile, size.width), y_end = min((ty + 1)*tile, size.height);
+				for (int y = ty*tile; y < y_end && !dirty[t]; y += MOTION_SAMPLE) {
+					const uchar *ref = reference.ptr<uchar>(y/MOTION_SAMPLE);
+					for (int x = tx*tile; x < x_end; x += MOTION_SAMPLE) {
+						if (abs(sample(src, i420, x, y) - ref[x/MOTION_SAMPLE]) > threshold) {
+							dirty[t] = 1;
+							break;
+						}
+					}
+				}
+			}
+		}
+		n_tiles += nx*ny;
+		return;
+	}
+
+	void dirty_rects(Rect region, vector<Rect> &rects) const
+	// Rectangles covering the dirty tiles that overlap region or border it (runs of neighbouring tiles along each row are
+	// merged); the bordering tiles are included because the dilation at a clean tile's edge depends on its neighbours
+	{
+		rects.clear();
+		Rect full(0, 0, size.width, size.height);
+		int tx0 = max(region.x/tile - 1, 0), tx1 = min((region.x + region.width - 1)/tile + 1, nx - 1);
+		int ty0 = max(region.y/tile - 1, 0), ty1 = min((region.y + region.height - 1)/tile + 1, ny - 1);
+		for (int ty = ty0; ty <= ty1; ty++) {
+			for (int tx = tx0; tx <= tx1; tx++) {
+				if (!dirty[ty*nx + tx]) continue;
+				int run = tx;
+				while (run + 1 <= tx1 && dirty[ty*nx + run + 1]) run++;
+				rects.push_back(Rect(tx*tile, ty*tile, (run - tx + 1)*tile, tile) & full);
+				tx = run;
+			}
+		}
+		return;
+	}
+
+	Rect halo(Rect r) const
+	// r grown by one pixel: classifying this also brings the dilation at the edges of neighbouring clean tiles up to date
+	{
+		return Rect(r.x - 1, r.y - 1, r.width + 2, r.height + 2) & Rect(0, 0, size.width, size.height);
+	}
+
+	void mark_classified(const Mat &src, bool i420, Rect region)
+	// Record that the tiles in region (a rectangle from dirty_rects) have been classified from src: they become clean,
+	// with new references
+	{
+		int tx0 = region.x/tile, tx1 = (region.x + region.width - 1)/tile;
+		int ty0 = region.y/tile, ty1 = (region.y + region.height - 1)/tile;
+		for (int ty = ty0; ty <= ty1; ty++) {
+			for (int tx = tx0; tx <= tx1; tx++) {
+				int t = ty*nx + tx;
+				if (!dirty[t]) continue;
+				int x_end = min((tx + 1)*tile, size.width), y_end = min((ty + 1)*tile, size.height);
+				for (int y = ty*tile; y < y_end; y += MOTION_SAMPLE) {
+					uchar *ref = reference.ptr<uchar>(y/MOTION_SAMPLE);
+					for (int x = tx*tile; x < x_end; x += MOTION_SAMPLE) {
+						ref[x/MOTION_SAMPLE] = sample(src, i420, x, y);
+					}
+				}
+				dirty[t] = 0;
+				fresh[t] = 1;
+				n_classified++;
+			}
+		}
+		return;
+	}
+
+	bool touched(Rect r, int margin) const
+	// True if any tile within margin pixels of r was classified in the current frame, so a blob with bounding box r may
+	// have changed (a margin of two label pixels covers the dilation reaching into a neighbouring tile and joining the blob)
+	{
+		r = Rect(r.x - margin, r.y - margin, r.width + 2*margin, r.height + 2*margin) & Rect(0, 0, size.width, size.height);
+		if (r.area() == 0) return true;
+		for (int ty = r.y/tile; ty <= (r.y + r.height - 1)/tile; ty++) {
+			for (int tx = r.x/tile; tx <= (r.x + r.width - 1)/tile; tx++) {
+				if (fresh[ty*nx + tx]) return true;
+			}
+		}
+		return false;
+	}
+};
+
+
+
+#endif
@@ -0,0 +1,144 @@
+// Header include guard
+#ifndef PARALLEL_H	// if parallel.h has not been included, include it, otherwise do not
+#define PARALLEL_H	// see end of file for corresponding #endif
+
+// General includes
+#include <vector>		// vector
+#include <atomic>		// atomic
+#include <thread>		// thread
+#include <mutex>		// mutex, unique_lock
+#include <condition_variable>	// condition_variable
+
+// Namespaces
+using namespace std;
+
+// Parallel definitions:
+#define PARALLEL_MIN_ROWS	32		// fewest label rows per stripe worth handing to another thread
+
+
+// Work split into horizontal stripes of an image
+struct StripeJob {
+	virtual void run(int stripe, int n_stripes) = 0;	// process one stripe (called once for each, from any thread)
+	virtual ~StripeJob() {}
+};
+
+
+// Pool of threads sharing the stripes of one job at a time
+// The calling thread works on stripes too, and each thread claims the next unclaimed stripe when it finishes one, so
+// a stripe that takes longer (e.g. one crossing a car) does not hold the others up. The helper threads sleep between
+// jobs; nothing is allocated per job.
+struct StripePool {
+	vector<thread> helpers;		// threads besides the caller
+	mutex lock;
+	condition_variable wake;	// a job is ready (or the pool is closing)
+	condition_variable done;	// every helper has finished the job
+	StripeJob *job;				// job being run
+	int n_stripes;				// stripes in the job
+	atomic<int> next;			// next stripe to claim
+	int n_busy;					// helpers still working on the job
+	long generation;			// number of jobs started
+	bool closing;
+
+	StripePool() : job(NULL), n_stripes(0), next(0), n_busy(0), generation(0), closing(false) {}
+
+	void open_pool(int n_threads)
+	// Start the helper threads (n_threads counts the caller, so 1 runs every job on the caller alone)
+	{
+		for (int i = 1; i < n_threads; i++) {
+			helpers.push_back(thread(&StripePool::help, this));
+		}
+		return;
+	}
+
+	int n_threads(void) const
+	// Threads working on each job, including the caller
+	{
+		return helpers.size() + 1;
+	}
+
+	void work(void)
+	// Process stripes until none are left unclaimed
+	{
+		int s;
+		while ((s = next.fetch_add(1)) < n_stripes) {
+			job->run(s, n_stripes);
+		}
+		return;
+	}
+
+	void help(void)
+	// Helper thread: wait for each job and share its stripes
+	{
+		long seen = 0;
+		unique_lock<mutex> guard(lock);
+		while (true) {
+			while (!closing && generation == seen) wake.wait(guard);
+			if (closing) return;
+			seen = generation;
+			guard.unlock();
+			work();
+			guard.lock();
+			if (--n_busy == 0) done.notify_one();
+		}
+	}
+
+	void run(StripeJob &stripe_job, int stripes)
+	// Run a job split into stripes and return once every stripe is done
+	{
+		if (helpers.empty() || stripes == 1) {
+			for (int s = 0; s < stripes; s++) stripe_job.run(s, stripes);
+			return;
+		}
+		{
+			unique_lock<mutex> guard(lock);
+			job = &stripe_job;
+			n_stripes = stripes;
+			next = 0;
+			n_busy = helpers.size();
+			generation++;
+		}
+		wake.notify_all();
+		work();
+		unique_lock<mutex> guard(lock);
+		while (n_busy > 0) done.wait(guard);
+		job = NULL;
+		return;
+	}
+
+	void close_pool(void)
+	// Stop the helper threads
+	{
+		{
+			unique_lock<mutex> guard(lock);
+			closing = true;
+		}
+		wake.notify_all();
+		for (int i = 0; i < helpers.size(); i++) helpers[i].join();
+		helpers.clear();
+		return;
+	}
+
+	~StripePool() {
+		close_pool();
+	}
+};
+
+
+inline int stripe_start(int rows, int stripe, int n_stripes)
+// First row of a stripe when rows are split as evenly as possible (stripe n_stripes gives rows)
+{
+	return (int)((long)rows*stripe/n_stripes);
+}
+
+
+inline int stripes_for(const StripePool *pool, int rows)
+// Number of stripes to split rows into: one per thread, but none smaller than PARALLEL_MIN_ROWS (1 if no pool)
+{
+	if (pool == NULL) return 1;
+	int n = rows/PARALLEL_MIN_ROWS;
+	return n < 1 ? 1 : (n < pool->n_threads() ? n : pool->n_threads());
+}
+
+
+
+#endif
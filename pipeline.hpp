@@ -0,0 +1,180 @@
+// Header include guard
+#ifndef PIPELINE_H	// if pipeline.h has not been included, include it, otherwise do not
+#define PIPELINE_H	// see end of file for corresponding #endif
+
+// General includes
+#include <vector>		// vector
+#include <atomic>		// atomic
+#include <unistd.h>		// usleep
+#include <stdint.h>		// uint64_t
+
+// OpenCV includes
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "common.hpp"
+
+// Namespaces
+using namespace std;
+using namespace cv;
+
+// Pipeline definitions:
+#define PIPE_WAIT_US		200		// time a stage sleeps while waiting for input (microseconds)
+#define PIPE_FRAMES			4		// captured frames that may wait for detection
+#define PIPE_RESULTS		8		// results that may wait to be published
+
+
+// Captured frame structure (passed from the capture stage to the detection stage)
+struct Frame {
+	Mat image;					// source image
+	long seq;					// frame sequence number (counts every frame captured, including dropped ones)
+	double time;				// time image collected (cv::getTickCount() ticks)
+	double time_read;			// time the frame entered the pipeline (differs from time for recordings)
+	uint64_t time_capture;		// monotonic capture time (us, see pub_clock_us), when it was read for recordings
+
+	// Default values
+	Frame() : seq(-1), time(0), time_read(0), time_capture(0) {}
+};
+
+
+// Detection results structure (passed from the detection stage to the publishing stage)
+struct Result {
+	vector<Car> cars_all;		// copy of every car's state after processing the frame
+	long seq;					// sequence number of the frame these results came from
+	double time;				// time that frame was collected (cv::getTickCount() ticks)
+	double time_read;			// time that frame entered the pipeline
+	uint64_t time_capture;		// monotonic capture time of that frame (us)
+	
+	// Default values
+	Result() : seq(-1), time(0), time_read(0), time_capture(0) {}
+};
+
+
+// Lock-free ring of buffer indices
+// Only one thread may push, but both ends may pop: the consumer takes the oldest index in the normal way and the
+// producer can take it back when the ring is full. Indices are claimed with a compare-and-swap on tail, so whichever
+// thread loses simply retries (or finds the ring empty).
+struct IndexRing {
+	vector< atomic<int> > slots;		// stored buffer indices
+	atomic<unsigned long> head;			// next position to push (producer only)
+	atomic<unsigned long> tail;			// next position to pop
+
+	IndexRing(int capacity) : slots(capacity), head(0), tail(0) {}
+
+	bool push(int idx)
+	// Store idx at the back of the ring, returns false if the ring is full
+	{
+		unsigned long h = head.load(memory_order_relaxed);
+		if (h - tail.load(memory_order_acquire) >= slots.size()) return false;
+		slots[h % slots.size()].store(idx, memory_order_relaxed);
+		head.store(h + 1, memory_order_release);
+		return true;
+	}
+
+	bool pop(int &idx)
+	// Take the oldest index from the ring, returns false if the ring is empty
+	{
+		unsigned long t = tail.load(memory_order_acquire);
+		while (t != head.load(memory_order_acquire)) {
+			idx = slots[t % slots.size()].load(memory_order_relaxed);
+			if (tail.compare_exchange_weak(t, t + 1, memory_order_acq_rel)) return true;	// t is reloaded on failure
+		}
+		return false;
+	}
+};
+
+
+// Single-producer single-consumer channel of preallocated buffers
+// The producer fills write_slot() and calls push(), it never blocks: if the consumer has fallen behind the oldest
+// queued buffer is dropped and reused. The consumer calls pop() (or wait_pop()) and may use the returned buffer
+// until its next call. Buffers are never allocated or copied after construction, only their indices move, so the
+// owner should size every element of buffers (e.g. allocate images) before the channel is used.
+template<typename T>
+struct Channel {
+	vector<T> buffers;			// preallocated buffers (capacity queued, one held by each end)
+	IndexRing ready;			// filled buffers, oldest first
+	IndexRing spare;			// buffers returned by the consumer
+	int write_idx;				// buffer held by the producer
+	int read_idx;				// buffer held by the consumer (-1 if none)
+	atomic<long> pushed;		// number of buffers pushed
+	atomic<long> dropped;		// number of buffers dropped because the consumer fell behind
+	atomic<bool> closed;		// set by the producer after its last push
+
+	Channel(int capacity) :
+		buffers(capacity + 2), ready(capacity), spare(capacity + 2),
+		write_idx(0), read_idx(-1), pushed(0), dropped(0), closed(false)
+	{
+		for (int i = 1; i < buffers.size(); i++) {
+			spare.push(i);
+		}
+	}
+
+	T &write_slot(void)
+	// Buffer the producer should fill before calling push()
+	{
+		return buffers[write_idx];
+	}
+
+	void push(void)
+	// Publish the producer's buffer and take a fresh one
+	{
+		int idx;
+		if (!ready.push(write_idx)) {
+			// Full: drop the oldest buffer and queue in its place
+			if (ready.pop(idx)) {
+				dropped++;
+				ready.push(write_idx);
+				write_idx = idx;
+				pushed++;
+				return;
+			}
+			ready.push(write_idx);	// consumer emptied the ring in the meantime
+		}
+		pushed++;
+
+		// Take a buffer returned by the consumer, or reclaim the oldest queued one
+		while (true) {
+			if (spare.pop(idx)) break;
+			if (ready.pop(idx)) {
+				dropped++;
+				break;
+			}
+		}
+		write_idx = idx;
+		return;
+	}
+
+	void close(void)
+	// Signal that the producer has finished
+	{
+		closed.store(true, memory_order_release);
+		return;
+	}
+
+	T *pop(void)
+	// Oldest published buffer, or NULL if none is waiting
+	// The previously popped buffer is handed back to the producer
+	{
+		int idx;
+		if (!ready.pop(idx)) return NULL;
+		if (read_idx >= 0) {
+			spare.push(read_idx);
+		}
+		read_idx = idx;
+		return &buffers[idx];
+	}
+
+	T *wait_pop(void)
+	// As pop(), but waits for a buffer to arrive, returns NULL once the producer has closed the channel and it is empty
+	{
+		while (true) {
+			bool was_closed = closed.load(memory_order_acquire);	// read before popping so the last push is not missed
+			T *buffer = pop();
+			if (buffer != NULL || was_closed) return buffer;
+			usleep(PIPE_WAIT_US);
+		}
+	}
+};
+
+
+
+#endif
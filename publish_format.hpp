@@ -0,0 +1,58 @@
+// Header include guard
+#ifndef PUBLISH_FORMAT_H	// if publish_format.h has not been included, include it, otherwise do not
+#define PUBLISH_FORMAT_H	// see end of file for corresponding #endif
+
+// Telemetry message layouts, shared by the tracker (publisher.hpp) and programs receiving its messages
+// JSON messages are one object per line (terminated by '\n'):
+//   {"time":<unix ms>,"seq":<frame>,"capture":<monotonic us>,"<MAC>":[1,x,y,v_x,v_y,theta,0,0],...}
+// seq is the capture sequence number of the newest frame the message was built from, so gaps show frames that were
+// dropped or not sent. capture is when its oldest frame was captured, on the CLOCK_MONOTONIC clock in microseconds
+// (see pub_clock_us), so a receiver on the same machine can measure how stale each message is.
+// Binary messages are one PubHeader followed by n_cars PubCar entries, all little-endian with no padding. The
+// length field at the start of the header gives the size of the whole message so a receiver can split the stream.
+
+// General includes
+#include <stdint.h>		// uint8_t, int16_t, uint32_t, uint64_t
+#include <time.h>		// clock_gettime
+
+// Message format definitions:
+#define PUB_MAGIC			0x42555053	// "SPUB" (little-endian), identifies a binary telemetry message
+#define PUB_VERSION			2			// 2 added the capture time
+#define PUB_TYPE_CAR		1			// object type sent for cars
+#define PUB_PORT			1520		// master controller port
+
+
+static inline uint64_t pub_clock_us(void)
+// Monotonic time in microseconds, the clock capture times are given on (unaffected by changes to the system time)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+
+// Binary message header
+struct __attribute__((packed)) PubHeader {
+	uint32_t length;			// bytes in the whole message, including this header
+	uint32_t magic;				// PUB_MAGIC
+	uint16_t version;			// PUB_VERSION
+	uint16_t n_cars;			// number of PubCar entries that follow (only cars that were found are sent)
+	uint32_t seq;				// frame sequence number
+	uint64_t time;				// unix time in milliseconds when the message was sent
+	uint64_t capture;			// monotonic time in microseconds when the frame was captured (see pub_clock_us)
+};
+
+
+// Binary message entry for one car (the same fields as the JSON array, keyed by the MAC address)
+struct __attribute__((packed)) PubCar {
+	uint8_t mac[6];				// MAC address
+	int16_t type;				// object type (PUB_TYPE_CAR)
+	int16_t x, y;				// position (mm)
+	int16_t v_x, v_y;			// velocity (mm/s)
+	int16_t orientation;		// orientation (degrees, 0 once the car is lost)
+	int16_t spare[2];			// zero
+};
+
+
+
+#endif
@@ -0,0 +1,380 @@
+// Header include guard
+#ifndef PUBLISHER_H	// if publisher.h has not been included, include it, otherwise do not
+#define PUBLISHER_H	// see end of file for corresponding #endif
+
+// General includes
+#include <iostream>		// cout
+#include <stdio.h>		// sscanf, fwrite
+#include <string.h>		// memcpy
+#include <errno.h>		// errno
+#include <fcntl.h>		// fcntl
+#include <unistd.h>		// close
+#include <sys/time.h>	// gettimeofday
+#include <sys/ioctl.h>	// ioctl
+
+// Socket/comms related includes
+#include <sys/socket.h>		// socket
+#include <netinet/in.h>		// IPPROTO_TCP
+#include <netinet/tcp.h>	// TCP_NODELAY
+#include <arpa/inet.h>		// inet_addr
+#include <linux/sockios.h>	// SIOCOUTQ
+
+#include "common.hpp"			// common definitions
+#include "publish_format.hpp"	// telemetry message layouts
+#include "shm_state.hpp"		// shared-memory state block
+#include "stats.hpp"			// publishing decision counters
+
+// Namespaces
+using namespace std;
+
+// Publisher definitions:
+#define PUB_HOST			"127.0.0.1"	// master controller address
+#define PUB_BUFFER			4096		// bytes available for one message
+#define PUB_MAC_CHARS		32			// longest MAC address string sent as a JSON key
+
+static_assert(sizeof(PubHeader) + MAX_CARS*sizeof(PubCar) <= PUB_BUFFER, "binary messages must fit the buffer");
+static_assert(MAX_CARS <= SHM_MAX_CARS, "the shared-memory state block must have room for every car");
+static_assert(28 + 3*21 + MAX_CARS*(PUB_MAC_CHARS + 6 + 8*12) <= PUB_BUFFER, "JSON messages must fit the buffer");
+
+
+char *put_int(char *p, long long value)
+// Write a decimal integer at p and return the position after it (no allocation or locale handling)
+// Takes a long long so millisecond and microsecond times also fit on 32-bit Pis
+{
+	char digits[20];
+	unsigned long long u = value < 0 ? -(unsigned long long)value : value;
+	int n = 0;
+	do {
+		digits[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u > 0);
+	if (value < 0) *p++ = '-';
+	while (n > 0) *p++ = digits[--n];
+	return p;
+}
+
+
+// Telemetry publisher
+// Each frame's car states are serialised into one reused buffer (newline-delimited JSON or length-prefixed binary, see
+// publish_format.hpp) and sent on a non-blocking TCP socket with Nagle's algorithm disabled. The tracker never waits
+// for the controller: if the previous message has not fully left the socket when the next one is ready, the rest of
+// the previous message is sent (so the stream stays splittable) and the new one is dropped, because the frame after
+// it will carry fresher data anyway.
+// Publishing is paced rather than delayed: a frame is skipped (its state is carried by the next one) only if the
+// target rate has already been reached, or if the controller has left more than publish_backlog bytes unread in the
+// socket's send queue, so an idle controller gets every frame with no added latency.
+struct Publisher {
+	int sock;					// socket connected to the controller (-1 in debug mode)
+	bool binary;				// send binary messages rather than JSON
+	float extrapolate_max;		// longest time (s) positions are extrapolated to the send time
+	uint8_t macs[MAX_CARS][6];	// MAC address of each car, parsed once for binary messages
+	char buffer[PUB_BUFFER];	// message being sent
+	size_t n_pending;			// bytes of the message still to be sent
+	size_t n_sent_bytes;		// bytes of the message already sent
+	long n_sent;				// messages sent completely
+	long n_dropped;				// messages dropped because the socket was still busy
+	long n_failed;				// messages lost to send errors
+	long n_paced;				// frames skipped to keep to the target rate
+	long n_backlogged;			// frames skipped because the controller was behind
+	double period;				// shortest average time between messages (ticks), 0 for no limit
+	double tick_due;			// time the next message may be sent (ticks)
+	int backlog_max;			// unread bytes allowed in the send queue, 0 for no limit
+
+	Publisher() : sock(-1), binary(false), extrapolate_max(0), n_pending(0), n_sent_bytes(0), n_sent(0), n_dropped(0),
+		n_failed(0), n_paced(0), n_backlogged(0), period(0), tick_due(0), backlog_max(0) {}
+
+	void set_pacing(const Config &config)
+	// Take the target rate and backlog limit from config (at start up and after a reload)
+	{
+		period = config.target_fps > 0 ? cv::getTickFrequency()/config.target_fps : 0;
+		backlog_max = config.publish_backlog;
+		extrapolate_max = config.extrapolate_max;
+		return;
+	}
+
+	bool open_publisher(const vector<Car> &cars_all, const Config &config, int output_mode)
+	// Check the cars' MAC addresses, then connect to the controller (except in debug mode, where messages are printed)
+	{
+		binary = config.publish_format == "binary";
+		set_pacing(config);
+		for (int i = 0; i < cars_all.size(); i++) {
+			unsigned int b[6];
+			if (cars_all[i].mac_add.size() > PUB_MAC_CHARS || sscanf(cars_all[i].mac_add.c_str(), "%x:%x:%x:%x:%x:%x",
+				&b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6) {
+				cout << "Error: invalid MAC address for " << cars_all[i].name << " car: " << cars_all[i].mac_add << endl;
+				return false;
+			}
+			for (int k = 0; k < 6; k++) macs[i][k] = b[k];
+		}
+		if (output_mode == 4) return true;
+
+		// Create socket
+		sock = socket(AF_INET , SOCK_STREAM , 0);
+		if (sock == -1) {
+			cout<< "Could not create socket" <<endl;
+			return false;
+		}
+		cout<< "Socket created" <<endl;
+
+		// Connect to remote server
+		struct sockaddr_in server;
+		server.sin_addr.s_addr = inet_addr(PUB_HOST);
+		server.sin_family = AF_INET;
+		server.sin_port = htons(PUB_PORT);
+		if (connect(sock , (struct sockaddr *)&server , sizeof(server)) < 0) {
+			cout<< "Connect failed. Error" << endl;
+			return false;
+		}
+		cout<< "Connected" << endl;
+
+		// Send small messages immediately and never block the tracker
+		int one = 1;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+		return true;
+	}
+
+	size_t format_json(const vector<Car> &cars_all, long seq, unsigned long long time_now, uint64_t time_capture, double time_ahead)
+	// Serialise the cars that were found as one line of JSON, returns its length
+	{
+		char *p = buffer;
+		memcpy(p, "{\"time\":", 8);
+		p = put_int(p + 8, time_now);
+		memcpy(p, ",\"seq\":", 7);
+		p = put_int(p + 7, seq);
+		memcpy(p, ",\"capture\":", 11);
+		p = put_int(p + 11, time_capture);
+		for (int i = 0; i < cars_all.size(); i++) {
+			const Car &car = cars_all[i];
+			if (car.area_new <= 0) continue;
+			*p++ = ',';
+			*p++ = '"';
+			memcpy(p, car.mac_add.data(), car.mac_add.size());	// MAC address key
+			p += car.mac_add.size();
+			memcpy(p, "\":[1,", 5);								// object type: 1 for cars
+			p = put_int(p + 5, lround(car.position_new[0] + car.velocity_new[0]*time_ahead));	// x-position
+			*p++ = ',';
+			p = put_int(p, lround(car.position_new[1] + car.velocity_new[1]*time_ahead));		// y-position
+			*p++ = ',';
+			p = put_int(p, lround(car.velocity_new[0]));		// x-velocity
+			*p++ = ',';
+			p = put_int(p, lround(car.velocity_new[1]));		// y-velocity
+			*p++ = ',';
+			p = put_int(p, car.orientation_new);				// orientation
+			memcpy(p, ",0,0]", 5);								// spares and closing array bracket
+			p += 5;
+		}
+		*p++ = '}';
+		*p++ = '\n';
+		return p - buffer;
+	}
+
+	size_t format_binary(const vector<Car> &cars_all, long seq, unsigned long long time_now, uint64_t time_capture, double time_ahead)
+	// Serialise the cars that were found as one binary message, returns its length
+	{
+		PubHeader header;
+		PubCar entry;
+		size_t n = sizeof(header);
+		for (int i = 0; i < cars_all.size(); i++) {
+			const Car &car = cars_all[i];
+			if (car.area_new <= 0) continue;
+			memcpy(entry.mac, macs[i], 6);
+			entry.type = PUB_TYPE_CAR;
+			entry.x = lround(car.position_new[0] + car.velocity_new[0]*time_ahead);
+			entry.y = lround(car.position_new[1] + car.velocity_new[1]*time_ahead);
+			entry.v_x = lround(car.velocity_new[0]);
+			entry.v_y = lround(car.velocity_new[1]);
+			entry.orientation = car.orientation_new;
+			entry.spare[0] = 0;
+			entry.spare[1] = 0;
+			memcpy(buffer + n, &entry, sizeof(entry));
+			n += sizeof(entry);
+		}
+		header.length = n;
+		header.magic = PUB_MAGIC;
+		header.version = PUB_VERSION;
+		header.n_cars = (n - sizeof(header))/sizeof(PubCar);
+		header.seq = seq;
+		header.time = time_now;
+		header.capture = time_capture;
+		memcpy(buffer, &header, sizeof(header));
+		return n;
+	}
+
+	bool flush(void)
+	// Send as much of the pending message as the socket will take, returns true once none is left
+	{
+		while (n_pending > 0) {
+			ssize_t n = send(sock, buffer + n_sent_bytes, n_pending, MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+				if (errno == EINTR) continue;
+				cout<< "Send failed" <<endl;
+				n_failed++;
+				n_pending = 0;
+				return true;
+			}
+			n_sent_bytes += n;
+			n_pending -= n;
+			if (n_pending == 0) n_sent++;
+		}
+		return true;
+	}
+
+	int queued(void) const
+	// Bytes in the socket's send queue that the controller has not yet acknowledged (0 if unknown)
+	{
+		int n = 0;
+		if (sock < 0 || ioctl(sock, SIOCOUTQ, &n) != 0) return 0;
+		return n;
+	}
+
+	int publish(const vector<Car> &cars_all, long seq, int output_mode, double time_new, uint64_t time_capture)
+	// Send the current state of every car that was found, returns what was decided (COUNT_SENT, COUNT_PACED,
+	// COUNT_BACKLOG or COUNT_BUSY, see stats.hpp)
+	// Messages carry the frame's sequence number and monotonic capture time (see publish_format.hpp)
+	// Positions are extrapolated (by at most extrapolate_max seconds) from the capture time to the time of sending
+	{
+		// Finish the previous message first, drop this one if the socket is still busy with it
+		if (sock >= 0 && !flush()) {
+			n_dropped++;
+			return COUNT_BUSY;
+		}
+
+		// Keep to the target rate: the next message is due one period after the previous one was due, so the average
+		// rate holds despite frame jitter, but is never more than one period in the past, so there is no burst after a gap
+		double tick = cv::getTickCount();
+		if (period > 0) {
+			if (tick < tick_due) {
+				n_paced++;
+				return COUNT_PACED;
+			}
+			tick_due = max(tick_due + period, tick - period);
+		}
+
+		// Skip frames while the controller is behind, the next frame sent carries the newest state
+		if (backlog_max > 0 && queued() > backlog_max) {
+			n_backlogged++;
+			return COUNT_BACKLOG;
+		}
+
+		// Time elapsed since the frame was captured
+		double time_ahead = double (tick - time_new) / double (cv::getTickFrequency());
+		if (time_ahead < 0) time_ahead = 0;
+		if (time_ahead > extrapolate_max) time_ahead = extrapolate_max;
+
+		// Unix time in milliseconds (python-compatible)
+		struct timeval tp;
+		gettimeofday(&tp, NULL);
+		unsigned long long time_now = (unsigned long long)(tp.tv_sec) * 1000 + (unsigned long long)(tp.tv_usec) / 1000;
+
+		if (output_mode == 4) {
+			// Debug mode - do not send output, do print JSON to console
+			size_t n = format_json(cars_all, seq, time_now, time_capture, time_ahead);
+			fwrite(buffer, 1, n, stdout);
+			return COUNT_SENT;
+		}
+		n_pending = binary ? format_binary(cars_all, seq, time_now, time_capture, time_ahead) : format_json(cars_all, seq, time_now, time_capture, time_ahead);
+		n_sent_bytes = 0;
+		flush();
+		return COUNT_SENT;
+	}
+
+	void close_publisher(void)
+	// Send what is left of the last message (waiting briefly if needed) and close the socket
+	{
+		if (sock < 0) return;
+		for (int i = 0; i < 100 && !flush(); i++) usleep(1000);
+		close(sock);
+		sock = -1;
+		cout << "Messages: " << n_sent << " sent, " << n_paced << " paced, " << n_backlogged << " skipped (controller behind), "
+			<< n_dropped << " dropped (socket busy), " << n_failed << " failed" << endl;
+		return;
+	}
+};
+
+
+// Shared-memory state writer (see shm_state.hpp)
+// Publishes the newest state of every car to local readers without system calls or waiting on them
+struct ShmWriter {
+	string name;				// shared-memory segment name
+	ShmState *state;			// mapped state block (NULL if not publishing to shared memory)
+	double time_start;			// tick count the capture times are measured from
+
+	ShmWriter() : state(NULL), time_start(0) {}
+
+	bool open_writer(const string &shm_name, const vector<Car> &cars_all, double time_start_)
+	// Create (or replace) the segment and fill in the parts of the block that do not change
+	{
+		name = shm_name;
+		time_start = time_start_;
+		shm_unlink(name.c_str());	// readers still mapping a previous tracker's block keep it, rather than seeing it change size
+		int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+		if (fd < 0 || ftruncate(fd, sizeof(ShmState)) != 0) {
+			cout << "Error: could not create shared-memory state block: " << name << endl;
+			if (fd >= 0) close(fd);
+			return false;
+		}
+		void *p = mmap(NULL, sizeof(ShmState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);	// the mapping stays valid
+		if (p == MAP_FAILED) {
+			cout << "Error: could not map shared-memory state block: " << name << endl;
+			return false;
+		}
+		state = (ShmState *)p;
+		memset(state, 0, sizeof(ShmState));
+		state->version = SHM_VERSION;
+		state->n_cars = cars_all.size();
+		state->writer_active = 1;
+		for (int i = 0; i < cars_all.size(); i++) {
+			strncpy(state->cars[i].name, cars_all[i].name.c_str(), SHM_NAME_CHARS - 1);
+			strncpy(state->cars[i].mac_add, cars_all[i].mac_add.c_str(), SHM_MAC_CHARS - 1);
+		}
+		__atomic_store_n(&state->magic, SHM_MAGIC, __ATOMIC_RELEASE);	// readers only accept the block once it is set
+		return true;
+	}
+
+	void write_state(const vector<Car> &cars_all, long seq, double time_new)
+	// Update the block with the current state of every car (seqlock write)
+	{
+		if (state == NULL) return;
+		uint32_t lock = state->seq;
+		__atomic_store_n(&state->seq, lock + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+
+		struct timeval tp;
+		gettimeofday(&tp, NULL);
+		state->frame = seq;
+		state->time_unix = (uint64_t)(tp.tv_sec) * 1000 + (uint64_t)(tp.tv_usec) / 1000;
+		state->time = (time_new - time_start)/(cv::getTickFrequency());
+		for (int i = 0; i < cars_all.size(); i++) {
+			ShmCar &car = state->cars[i];
+			car.found = cars_all[i].area_new > 0;
+			car.n_coast = cars_all[i].n_coast;
+			car.area = cars_all[i].area_new;
+			car.position[0] = cars_all[i].position_new[0];
+			car.position[1] = cars_all[i].position_new[1];
+			car.velocity[0] = cars_all[i].velocity_new[0];
+			car.velocity[1] = cars_all[i].velocity_new[1];
+			car.orientation = cars_all[i].orientation_new;
+		}
+
+		__atomic_store_n(&state->seq, lock + 2, __ATOMIC_RELEASE);
+		return;
+	}
+
+	void close_writer(void)
+	// Tell readers the tracker has stopped, then remove the segment (readers keep their mapping until they close it)
+	{
+		if (state == NULL) return;
+		__atomic_store_n(&state->writer_active, 0, __ATOMIC_RELEASE);
+		munmap(state, sizeof(ShmState));
+		state = NULL;
+		shm_unlink(name.c_str());
+		return;
+	}
+};
+
+
+
+#endif
@@ -0,0 +1,305 @@
+// Re-runs detection and tracking over a recorded session faster than real time, with one or more sets of parameters
+// Usage: ./reanalyse recording [parameter set]...
+// A parameter set is either a config file in the format of config.txt, or car overrides applied to config.txt such as
+// "red.hue=120,red.delta=8,blue.size_min=300" (hue, delta, size_min and size_max can be changed). With no sets given,
+// config.txt is used on its own. If a config has Camera blocks, the first camera's crop, origin, scale and static mask
+// are used. Each set excludes its static mask and obstacles as the tracker would, but the mask is only loaded (a
+// recording is no view of the empty arena, so a missing mask is not calibrated and only obstacles are excluded).
+// Each frame is decoded once and searched with every set. Every car is searched for in the full frame, so frames do
+// not depend on each other and are shared between all cores; each set's measurements are then tracked in frame order
+// using the recorded capture times. With no track to predict from while searching, candidates are chosen between on
+// hue and area alone (see associate.hpp). Results are written in the layout of log2csv: log.csv for a single set, or
+// log_1.csv, log_2.csv, ... (in the order the sets were given).
+
+// General includes
+#include <iostream>		// cout
+#include <sstream>		// stringstream
+#include <stdio.h>		// fopen, fprintf
+#include <stdlib.h>		// atoi
+#include <thread>		// thread::hardware_concurrency
+
+// Algorithm-specific includes
+#include "shmo.hpp"		// do_lut, do_classify, find_car
+#include "common.hpp"	// common definitions
+#include "pipeline.hpp"	// Frame
+#include "frame_source.hpp"	// recordings
+#include "logger.hpp"	// do_record
+#include "parallel.hpp"	// StripePool
+#include "associate.hpp"	// Association
+#include "static_mask.hpp"	// static distractor exclusion
+
+// OpenCV interfacing includes
+#include "opencv2/imgproc/imgproc.hpp"
+
+// Namespaces
+using namespace std;
+using namespace cv;
+
+// Re-analysis definitions:
+#define REANALYSE_BATCH		8		// frames decoded per thread before they are searched
+
+
+// One set of parameters being tried, with its tracking state and output
+struct ParamSet {
+	string label;				// config file or overrides the set came from
+	Config config;				// parameters (with the first camera's crop, origin, scale and static mask)
+	vector<Car> cars_all;		// tracked state of every car
+	vector<uchar> lut;			// BGR (or chroma) -> car lookup table
+	StaticMask mask;			// car bits kept at each label pixel (static distractors and obstacles removed)
+	FILE *csv;					// trajectory output
+	string csv_name;
+	vector<long> n_found;		// frames each car was detected in
+
+	ParamSet() : csv(NULL) {}
+};
+
+
+// Measurement of one car in one frame (pixels, area -1 if not found)
+struct Measurement {
+	float x, y;
+	float area;
+};
+
+
+bool apply_overrides(const string &list, vector<Car> &cars_all)
+// Change car parameters from a comma separated list of car.field=value, returns false if one cannot be applied
+{
+	stringstream ss(list);
+	string item;
+	while (getline(ss, item, ',')) {
+		size_t dot = item.find('.'), equals = item.find('=');
+		if (dot == string::npos || equals == string::npos || equals < dot) {
+			cout << "Error: expected car.field=value, not " << item << endl;
+			return false;
+		}
+		string name = item.substr(0, dot), field = item.substr(dot + 1, equals - dot - 1);
+		int value = atoi(item.c_str() + equals + 1);
+		int i = 0;
+		while (i < cars_all.size() && cars_all[i].name != name) i++;
+		if (i == cars_all.size()) {
+			cout << "Error: no " << name << " car in config.txt" << endl;
+			return false;
+		}
+		if (field == "hue")				cars_all[i].hue = value;
+		else if (field == "delta")		cars_all[i].delta = value;
+		else if (field == "size_min")	cars_all[i].size_min = value;
+		else if (field == "size_max")	cars_all[i].size_max = value;
+		else {
+			cout << "Error: " << field << " cannot be overridden (hue, delta, size_min or size_max)" << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// A batch of decoded frames, each searched with every parameter set (one frame per stripe)
+// Each frame of the batch has its own scratch buffers and copies of the cars, so any thread can take any frame
+struct BatchSearch : StripeJob {
+	vector<ParamSet> *sets;
+	int n_cars;
+	int step;						// label decimation (2 for I420 frames, labelled on their chroma planes)
+	vector<Frame> frames;			// frames of the batch
+	vector<Mat> labels, rows;		// label image and do_classify scratch rows for each frame
+	vector<BlobFinder *> finders;	// blob extractor for each frame
+	vector<Association> associations;	// candidates of each frame and the choices made between them
+	vector<vector<Car> > cars;		// find_car output for each frame and set
+	vector<Measurement> measured;	// [set][frame][car]
+
+	BatchSearch() : sets(NULL), n_cars(0), step(1) {}
+
+	void open_search(vector<ParamSet> &param_sets, int n_frames, const FrameSource &source)
+	// Allocate the buffers for batches of up to n_frames frames
+	{
+		sets = &param_sets;
+		n_cars = param_sets[0].cars_all.size();
+		step = source.i420 ? 2 : 1;
+		frames.resize(n_frames);
+		labels.resize(n_frames);
+		rows.resize(n_frames);
+		finders.resize(n_frames);
+		associations.resize(n_frames);
+		cars.resize(n_frames*sets->size());
+		for (int f = 0; f < n_frames; f++) {
+			labels[f] = Mat::zeros(source.size.height/step, source.size.width/step, CV_8UC1);
+			rows[f] = Mat::zeros(CLASSIFY_ROWS, source.size.width + 2, CV_8UC1);
+			finders[f] = new BlobFinder();
+			associations[f].open_association(n_cars);
+			for (int k = 0; k < sets->size(); k++) cars[f*sets->size() + k] = (*sets)[k].cars_all;
+		}
+		measured.resize(sets->size()*n_frames*n_cars);
+		return;
+	}
+
+	Measurement &measurement(int set, int frame, int car)
+	{
+		return measured[(set*frames.size() + frame)*n_cars + car];
+	}
+
+	void run(int f, int n_frames)
+	// Label and search one frame with every parameter set
+	{
+		Rect full(0, 0, labels[f].cols, labels[f].rows);
+		for (int k = 0; k < sets->size(); k++) {
+			const ParamSet &set = (*sets)[k];
+			vector<Car> &found = cars[f*sets->size() + k];
+			do_classify(frames[f].image, labels[f], rows[f], set.lut, set.config.crop, full, step, set.mask.keep);
+			for (int jj = 0; jj < n_cars; jj++) {
+				find_candidates(labels[f], 1 << jj, jj, found[jj], Point(0, 0), *finders[f], associations[f].candidates,
+					associations[f].n_overflow, step);
+			}
+			associations[f].associate(found, set.config, frames[f].image, set.lut);
+			for (int jj = 0; jj < n_cars; jj++) {
+				Measurement &m = measurement(k, f, jj);
+				m.x = found[jj].position_new[0];
+				m.y = found[jj].position_new[1];
+				m.area = found[jj].area_new;
+			}
+		}
+		return;
+	}
+
+	~BatchSearch() {
+		for (int f = 0; f < finders.size(); f++) delete finders[f];
+	}
+};
+
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		cout << "Usage: ./reanalyse recording [config file or car.field=value,...]..." << endl;
+		return 1;
+	}
+
+	// Parameter sets
+	Config config_base;
+	vector<Car> cars_base;
+	if (!do_config(cars_base, config_base)) return 1;
+	int n_sets = max(argc - 2, 1);
+	vector<ParamSet> sets(n_sets);
+	for (int k = 0; k < n_sets; k++) {
+		ParamSet &set = sets[k];
+		set.label = argc > 2 ? argv[k + 2] : "config.txt";
+		if (set.label.find('=') != string::npos) {
+			set.config = config_base;
+			set.cars_all = cars_base;
+			if (!apply_overrides(set.label, set.cars_all)) return 1;
+		} else if (!do_config(set.cars_all, set.config, set.label.c_str())) {
+			return 1;
+		}
+		if (set.cars_all.size() != cars_base.size()) {
+			cout << "Error: " << set.label << " must configure the same cars as config.txt" << endl;
+			return 1;
+		}
+		if (!set.config.cameras.empty()) {
+			set.config.crop = set.config.cameras[0].crop;
+			set.config.origin[0] = set.config.cameras[0].origin[0];
+			set.config.origin[1] = set.config.cameras[0].origin[1];
+			set.config.scale = set.config.cameras[0].scale;
+			set.config.static_mask = set.config.cameras[0].static_mask;
+		}
+		set.n_found.assign(set.cars_all.size(), 0);
+	}
+	int n_cars = cars_base.size();
+
+	// Recording, read as fast as possible (frame times still come from the recorded capture times)
+	Config config_source = config_base;
+	config_source.replay_realtime = 0;
+	FrameSource *source = make_source(argv[1], config_source);
+	if (source == NULL || !source->open_source()) {
+		cout << "Error: could not open recording " << argv[1] << endl;
+		return 1;
+	}
+	if (source->type != (source->i420 ? CV_8UC1 : CV_8UC3)) {
+		cout << "Error: frames must be 8-bit BGR or I420" << endl;
+		return 1;
+	}
+
+	// Lookup tables, static masks (never calibrated here) and output files
+	for (int k = 0; k < n_sets; k++) {
+		ParamSet &set = sets[k];
+		int step = source->i420 ? 2 : 1;
+		set.mask.open_mask(set.config.static_mask, source->size, step, step, set.config.obstacles, set.config.scale,
+			set.config.origin, 0);
+		if (source->i420) {
+			do_lut_uv(set.cars_all, set.lut);
+		} else {
+			do_lut(set.cars_all, set.lut);
+		}
+		set.csv_name = n_sets == 1 ? string("log.csv") : "log_" + to_string(k + 1) + ".csv";
+		set.csv = fopen(set.csv_name.c_str(), "w");
+		if (set.csv == NULL) {
+			cout << "Error: could not open " << set.csv_name << endl;
+			return 1;
+		}
+		log_csv_header(set.csv, n_cars);
+	}
+
+	// Every core searches frames, the main thread decodes each batch and tracks it
+	StripePool pool;
+	pool.open_pool(max((int)thread::hardware_concurrency(), 1));
+	BatchSearch search;
+	search.open_search(sets, pool.n_threads()*REANALYSE_BATCH, *source);
+	cout << "Re-analysing " << argv[1] << " with " << n_sets << " parameter set" << (n_sets > 1 ? "s" : "") << " on "
+		<< pool.n_threads() << " thread" << (pool.n_threads() > 1 ? "s" : "") << endl;
+
+	double tick_start = cv::getTickCount();
+	double time_start = 0, time_last = 0;		// recorded times of the first and last frames (ticks)
+	long n_total = 0;
+	LogRecord record;
+	while (true) {
+		int n = 0;
+		while (n < search.frames.size() && source->read(search.frames[n])) n++;
+		if (n == 0) break;
+		pool.run(search, n);
+
+		// Track each set's measurements in frame order
+		if (n_total == 0) time_start = search.frames[0].time;
+		for (int k = 0; k < n_sets; k++) {
+			ParamSet &set = sets[k];
+			for (int f = 0; f < n; f++) {
+				double time_new = search.frames[f].time;
+				for (int jj = 0; jj < n_cars; jj++) {
+					Car &car = set.cars_all[jj];
+					const Measurement &m = search.measurement(k, f, jj);
+					car.position_new[0] = m.x;
+					car.position_new[1] = m.y;
+					car.area_new = m.area;
+					if (m.area >= 0) set.n_found[jj]++;
+					car.px_to_mm(set.config.scale, set.config.origin);
+					do_track(car, set.config, time_new);
+				}
+				do_record(record, set.cars_all, n_cars, time_new, time_start);
+				log_csv_row(set.csv, record, n_cars);
+			}
+		}
+		time_last = search.frames[n - 1].time;
+		n_total += n;
+	}
+	double time_total = (cv::getTickCount() - tick_start)/cv::getTickFrequency();
+	double time_recorded = (time_last - time_start)/cv::getTickFrequency();
+	pool.close_pool();
+	source->release();
+	delete source;
+
+	// Summary
+	long n_ambiguous = 0, n_shared = 0;
+	for (int f = 0; f < search.associations.size(); f++) {
+		n_ambiguous += search.associations[f].n_ambiguous;
+		n_shared += search.associations[f].n_shared;
+	}
+	cout << "Frames: " << n_total << " (" << time_recorded << " s recorded) in " << time_total << " s: "
+		<< n_total/time_total << " fps, " << time_recorded/time_total << "x real time" << endl;
+	for (int k = 0; k < n_sets; k++) {
+		ParamSet &set = sets[k];
+		fclose(set.csv);
+		cout << set.csv_name << " (" << set.label << "):";
+		for (int jj = 0; jj < n_cars; jj++) {
+			printf(" %s %.1f%%", set.cars_all[jj].name.c_str(), n_total > 0 ? 100.0*set.n_found[jj]/n_total : 0.0);
+		}
+		cout << " of frames detected" << endl;
+	}
+	cout << "Association (all sets): " << n_ambiguous << " cars with several candidates, " << n_shared << " blobs matching several cars" << endl;
+	return 0;
+}
@@ -0,0 +1,111 @@
+// Header include guard
+#ifndef SHM_STATE_H	// if shm_state.h has not been included, include it, otherwise do not
+#define SHM_STATE_H	// see end of file for corresponding #endif
+
+// Shared-memory state block, written by the tracker (ShmWriter in publisher.hpp) and read by local programs
+// The tracker keeps the newest state of every car in a POSIX shared-memory segment guarded by a seqlock: the writer
+// makes seq odd, updates the block and makes seq even again, and a reader retries its copy if seq was odd or changed
+// while it was copying. Readers never block the tracker and need no system calls once the segment is mapped.
+// This header only uses C features and GCC atomic builtins, so the reader functions can also be used from C programs
+// (link with -lrt on older systems).
+
+// General includes
+#include <stdint.h>		// uint32_t, uint64_t
+#include <string.h>		// memcpy
+#include <fcntl.h>		// O_RDONLY
+#include <unistd.h>		// close
+#include <sys/mman.h>	// shm_open, mmap
+#include <sys/stat.h>	// fstat
+
+// State block definitions:
+#define SHM_MAGIC			0x54534853	// "SHST" (little-endian), identifies the state block
+#define SHM_VERSION			1
+#define SHM_MAX_CARS		8			// cars with room in the block (must be at least MAX_CARS)
+#define SHM_NAME_CHARS		16			// car name characters stored (including the terminating zero)
+#define SHM_MAC_CHARS		32			// MAC address characters stored (including the terminating zero)
+
+
+// State of one car
+struct ShmCar {
+	char name[SHM_NAME_CHARS];	// car name, usually its colour
+	char mac_add[SHM_MAC_CHARS];	// MAC address
+	int32_t found;				// 1 if the car was detected (or is being predicted through a missed detection)
+	int32_t n_coast;			// consecutive frames predicted without a detection
+	float area;					// measured area (pixels), -1 if not found
+	float position[2];			// estimated position (mm)
+	float velocity[2];			// estimated velocity (mm/s)
+	int32_t orientation;		// estimated orientation (degrees, 0 once the car is lost)
+};
+
+
+// Shared-memory state block
+struct ShmState {
+	uint32_t magic;				// SHM_MAGIC
+	uint32_t version;			// SHM_VERSION
+	uint32_t seq;				// seqlock sequence, odd while the writer is updating the block
+	uint32_t writer_active;		// 0 once the tracker has exited (a new tracker creates a new segment)
+	uint32_t n_cars;			// number of cars with data
+	uint32_t pad;
+	uint64_t frame;				// frame sequence number of the state
+	uint64_t time_unix;			// unix time (ms) when the state was written
+	double time;				// capture time of the frame (seconds since the tracker started)
+	struct ShmCar cars[SHM_MAX_CARS];
+};
+
+
+// Reader handle (a mapping of the state block)
+struct ShmReader {
+	const struct ShmState *state;	// NULL if not open
+};
+
+
+static inline int shm_open_reader(struct ShmReader *reader, const char *name)
+// Map the tracker's state block read-only, returns 1 on success
+{
+	reader->state = NULL;
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) return 0;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct ShmState)) {
+		close(fd);
+		return 0;
+	}
+	void *p = mmap(NULL, sizeof(struct ShmState), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);	// the mapping stays valid
+	if (p == MAP_FAILED) return 0;
+	reader->state = (const struct ShmState *)p;
+	if (reader->state->magic != SHM_MAGIC || reader->state->version != SHM_VERSION) {
+		munmap(p, sizeof(struct ShmState));
+		reader->state = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+
+static inline int shm_read_state(const struct ShmReader *reader, struct ShmState *snapshot)
+// Copy a consistent snapshot of the newest state, returns 0 if the tracker has not written a state yet
+{
+	uint32_t seq_before, seq_after;
+	do {
+		seq_before = __atomic_load_n(&reader->state->seq, __ATOMIC_ACQUIRE);
+		if (seq_before & 1) continue;	// writer is part way through an update
+		memcpy(snapshot, reader->state, sizeof(struct ShmState));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq_after = __atomic_load_n(&reader->state->seq, __ATOMIC_RELAXED);
+	} while ((seq_before & 1) || seq_before != seq_after);
+	snapshot->seq = seq_before;
+	return seq_before != 0;
+}
+
+
+static inline void shm_close_reader(struct ShmReader *reader)
+// Unmap the state block
+{
+	if (reader->state != NULL) munmap((void *)reader->state, sizeof(struct ShmState));
+	reader->state = NULL;
+}
+
+
+
+#endif
@@ -5,164 +5,285 @@
 #include <sstream>		// ?
 #include <unistd.h>		// sleep
 #include <math.h>		// atan2
+#include <thread>		// thread
 
 // Algorithm-specific includes
 #include "shmo.hpp"		// specific to this algorithm
 #include "common.hpp"	// common definitions
+#include "pipeline.hpp"	// frame/result channels between threads
+#include "frame_source.hpp"	// camera and recordings
+#include "camera_worker.hpp"	// per-camera capture and detection
+#include "stats.hpp"	// latency statistics
+#include "publisher.hpp"	// telemetry to the master controller
+#include "control.hpp"	// control socket and config reloads
 
-// OpenCV and camera interfacing includes
-#include "/home/pi/raspicam-0.1.6/src/raspicam_cv.h"	// camera
+// OpenCV interfacing includes
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv/highgui.h"
 
-// Socket/comms related includes
-#include<sys/socket.h>	// socket
-#include<arpa/inet.h>	// inet_addr
-
-#define PI 3.14159265
-
 // Namespaces
 using namespace std;
 using namespace cv;
 
 int main(int argc,char **argv)
 {
-	int n_frames = atoi(argv[1]);		// number of frames to process
+	long n_frames = atol(argv[1]);		// number of frames to process, 0 to run as a daemon until told to quit
 	int output_mode = atoi(argv[2]);	// output mode
-	int delay = atoi(argv[3]);			// delay in milliseconds
-	
-	// Camera setup
-	raspicam::RaspiCam_Cv Camera;
-	cam_setup(Camera);
-	if (!Camera.open()) {
-		// open camera
-        cerr<<"Error opening camera"<<endl;
-        return -1;
-    }
-	sleep(2);	// sleep required to wait for camera to "warm up"
-	
-	// Grab a test image to allocate hsv Mat
-	Mat src;
-	Camera.grab();
-	Camera.retrieve(src);										// source image
-	Mat src_hsv = Mat::zeros(src.rows, src.cols, CV_8UC3);		// HSV version (only one copy, overwritten for each car)
+	int delay = atoi(argv[3]);			// shortest time between messages in milliseconds, 0 to use target_fps from config.txt
 	
 	// Configure global parameters and Car structs
-	int crop;
-	float origin[2];
-	float scale;
-	int min_speed;
+	Config config;
 	vector<Car> cars_all;
-	do_config(cars_all, crop, origin, scale, min_speed);	// read config file
+	do_config(cars_all, config);	// read config file
+	const Config config_start = config;		// reloads are checked against the start up parameters
+	const vector<Car> cars_start = cars_all;
+	if (delay > 0) config.target_fps = 1000.0/delay;
 	
-	// Configure vector for masks
-	vector<Mat> masks_all;
-	for (int i = 0; i < cars_all.size(); i++) {
-		Mat mask = Mat::zeros(src.rows, src.cols, CV_8UC1);
-		masks_all.push_back(mask);
+	// Cameras: one per Camera block of config.txt, or a single camera using the global parameters
+	// Sources given on the command line replace the configured ones in order (live camera unless a recording is given)
+	if (config.cameras.empty()) {
+		CameraConfig camera;
+		camera.crop = config.crop;
+		camera.origin[0] = config.origin[0];
+		camera.origin[1] = config.origin[1];
+		camera.scale = config.scale;
+		camera.record = config.record;
+		camera.static_mask = config.static_mask;
+		config.cameras.push_back(camera);
+	}
+	for (int i = 4; i < argc && i - 4 < config.cameras.size(); i++) {
+		config.cameras[i - 4].source = argv[i];
 	}
+	int n_cameras = config.cameras.size();
+	
+	// Frame source setup and buffers for each camera
+	vector<CameraWorker *> workers(n_cameras);
+	for (int i = 0; i < n_cameras; i++) {
+		workers[i] = new CameraWorker();
+		if (!workers[i]->open_worker(i, config.cameras[i], config, cars_all)) {
+			return -1;
+		}
+	}
+	Control control;	// control commands (start, stop, mode, stats, reload, quit) and config reloads
+	for (int i = 0; i < n_cameras; i++) {
+		workers[i]->paused = &control.paused;
+	}
+	Stats stats;	// outputs, publishing and latency (the workers time their own stages)
+	signal(SIGUSR1, on_stats_signal);
 	
 	// Output mode
 	output_mode = state_output_mode(output_mode);
+	Logger logger;
 	if (output_mode > 1) {
-		// Set up csv log file (data.csv)
-		FILE * log_csv;
-		log_csv = fopen("log.csv","w");	// clear log file
-		fprintf(log_csv,"time(s)");
-		for (int i = 0; i < cars_all.size(); i++) {
-			// Print one lot of headers for each car
-			fprintf(log_csv,",area,x,y,v_x,v_y,theta");
-		}
-		fprintf(log_csv,"\n");
-		fclose(log_csv);
+		// Set up binary log file (convert to log.csv with log2csv)
+		logger.open_log("log.bin", cars_all.size());
 	}
 	
-	// Create socket
-	int sock;
-	sock = socket(AF_INET , SOCK_STREAM , 0);
-	if (sock == -1) {
-		cout<< "Could not create socket" <<endl;
+	// Connect to the master controller (not in debug mode)
+	Publisher publisher;
+	if (!publisher.open_publisher(cars_all, config, output_mode)) {
 		return 1;
 	}
-	cout<< "Socket created" <<endl;
 	
-	// Set up server connection if not in debug mode
-	if (output_mode != 4) {
-		struct sockaddr_in server;
-		server.sin_addr.s_addr = inet_addr("127.0.0.1");
-		server.sin_family = AF_INET;
-		server.sin_port = htons(1520);
+	// Run tracking
+	// Each camera has capture and detection threads (see CameraWorker), this thread merges their results, tracks the
+	// cars and publishes. Capture never waits for the later stages - if they fall behind the oldest waiting frame/result
+	// is dropped
+	double time_start = cv::getTickCount();
+	
+	// Shared-memory state for local readers (in addition to the controller socket)
+	ShmWriter shm_writer;
+	if (!config.shm_name.empty()) {
+		shm_writer.open_writer(config.shm_name, cars_all, time_start);
+	}
 	
-		// Connect to remote server
-		if (connect(sock , (struct sockaddr *)&server , sizeof(server)) < 0) {
-			cout<< "Connect failed. Error" << endl;
-			return 1;
-		}
-		cout<< "Connected" << endl;
+	for (int i = 0; i < n_cameras; i++) {
+		workers[i]->start(n_frames);
 	}
 	
-	// Run tracking
-	double time_new, time_old;
-	double time_start = cv::getTickCount();
-	for (int ii = 0; ii < n_frames; ii++) {
-		// Get HSV image	
-		Camera.grab();
-		time_new = cv::getTickCount();			// time image collected
-		Camera.retrieve(src);
-		cvtColor(src, src_hsv, COLOR_BGR2HSV);	// convert to HSV
-		
-		for (int jj = 0; jj < cars_all.size(); jj++) {
-			// Generate masks of matching hues
-			do_mask(src_hsv, masks_all[jj], cars_all[jj].hue, cars_all[jj].delta, crop, cars_all[jj].name);
-			
-			// Detect cars
-			find_car(masks_all[jj], cars_all[jj]);
-			
-			// Convert measurements to mm
-			cars_all[jj].px_to_mm(scale, origin);
-			
-			// Calculate velocity
-			do_velocity(cars_all[jj], time_new, time_old);
-			
-			// Determine orientation
-			if (cars_all[jj].speed() > min_speed) {
-				cars_all[jj].orientation_new = (int)(90 - 180/PI*atan2(cars_all[jj].velocity_new[1], cars_all[jj].velocity_new[0]));
-				if (cars_all[jj].orientation_new < 0) {
-					cars_all[jj].orientation_new = 360 + cars_all[jj].orientation_new;
-				}
+	// Latency statistics of every thread combined
+	auto print_stats = [&](FILE *out) {
+		Stats total;
+		total.add(stats);
+		for (int i = 0; i < n_cameras; i++) total.add(workers[i]->stats);
+		total.print(out);
+	};
+	
+	// Config reloads (SIGHUP, a change to config.txt or the reload command)
+	// The new parameters and lookup tables are built on the control thread, each stage swaps them in between frames
+	atomic<Tuning *> tuning(NULL);	// reloaded parameters for this stage
+	RetiredTunings retired;			// parameters this stage has swapped out (freed here, on the control thread)
+	auto reload = [&]() {
+		Config tuned;
+		vector<Car> tuned_cars;
+		if (!do_config(tuned_cars, tuned) || !check_tuning(cars_start, config_start, tuned_cars, tuned)) {
+			return false;
+		}
+		if (delay > 0) tuned.target_fps = 1000.0/delay;	// the command line still overrides config.txt
+		for (int i = 0; i < n_cameras; i++) {
+			Tuning *t = new Tuning();
+			t->config = tuned;
+			t->cars_all = tuned_cars;
+			if (workers[i]->source->i420) {
+				do_lut_uv(tuned_cars, t->lut);
 			} else {
-				cars_all[jj].orientation_new = 0;
+				do_lut(tuned_cars, t->lut);
 			}
+			workers[i]->retune(t);
 		}
+		Tuning *t = new Tuning();
+		t->config = tuned;
+		t->cars_all = tuned_cars;
+		delete tuning.exchange(t);
+		retired.free_all();
+		return true;
+	};
+	control.report = print_stats;
+	control.reload = reload;
+	control.calibrate = [&]() {
+		for (int i = 0; i < n_cameras; i++) workers[i]->calibrate_requested = true;
+	};
+	control.open_control(config.control_socket, output_mode);
+	
+	// Merging, tracking and publishing stage
+	long n_published = 0;
+	bool stopping = false, was_paused = false;
+	vector<Result *> pending(n_cameras, NULL);		// newest result from each camera not yet merged
+	while (true) {
+		// Gather a result from every camera, waiting at most merge_wait once the first has arrived
+		int n_pending = 0, n_running = 0;
+		double tick_first = 0;
+		while (true) {
+			if (control.quit.load() && !stopping) {
+				// Stop capturing, frames already captured are still processed
+				for (int i = 0; i < n_cameras; i++) workers[i]->stop();
+				stopping = true;
+			}
+			if (control.paused.load()) was_paused = true;
+			n_pending = 0;
+			n_running = 0;
+			for (int i = 0; i < n_cameras; i++) {
+				bool was_closed = workers[i]->results.closed.load(memory_order_acquire);
+				Result *r;
+				while ((r = workers[i]->results.pop()) != NULL) pending[i] = r;	// keep the newest
+				if (pending[i] != NULL) n_pending++;
+				if (!was_closed) n_running++;
+			}
+			if (n_pending > 0 && tick_first == 0) tick_first = cv::getTickCount();
+			if (n_pending == n_cameras || (n_pending > 0 && n_pending >= n_running)) break;
+			if (n_pending > 0 && (cv::getTickCount() - tick_first)/cv::getTickFrequency()*1000 >= config.merge_wait) break;
+			if (n_pending == 0 && n_running == 0) break;
+			usleep(PIPE_WAIT_US);
+		}
+		if (n_pending == 0) break;	// all cameras have finished
 		
-		// Other outputs (console, csv and/or images)
+		// Swap in reloaded parameters and output mode changes between frames
+		Tuning *t = tuning.exchange(NULL);
+		if (t != NULL) {
+			do_retune(cars_all, config, *t);
+			publisher.set_pacing(config);
+			retired.retire(t);
+		}
+		int mode = control.output_mode.load();
+		if (mode != output_mode && output_mode != 4) {
+			output_mode = state_output_mode(mode);
+			if (output_mode > 1 && logger.fd < 0) {
+				logger.open_log("log.bin", cars_all.size());
+			}
+		}
+		if (was_paused) {
+			do_reset_tracks(cars_all);	// estimates from before the pause are too old to predict from
+			was_paused = false;
+		}
+		
+		// Merge the cameras' measurements and track each car in the world frame
+		double time_new = 0, time_read = 0;
+		uint64_t time_capture = 0;	// capture of the oldest frame merged (for the controller's latency)
+		long seq = -1;
+		for (int i = 0; i < n_cameras; i++) {
+			if (pending[i] == NULL) continue;
+			time_new = max(time_new, pending[i]->time);
+			time_read = time_read == 0 ? pending[i]->time_read : min(time_read, pending[i]->time_read);
+			time_capture = time_capture == 0 ? pending[i]->time_capture : min(time_capture, pending[i]->time_capture);
+			seq = max(seq, pending[i]->seq);
+		}
+		merge_results(cars_all, &pending[0], n_cameras, config.merge_distance, time_new);
+		for (int jj = 0; jj < cars_all.size(); jj++) {
+			do_track(cars_all[jj], config, time_new);
+		}
+		for (int i = 0; i < n_cameras; i++) pending[i] = NULL;
+		
+		// Other outputs (console and/or csv)
+		double tick = cv::getTickCount();
 		if (output_mode == 4) {
-			do_debug(cars_all, src, masks_all, ii, output_mode, time_new, time_start);
+			do_debug(cars_all, Mat(), Mat(), logger, seq, output_mode, time_new, time_start);
 		} else {
-			do_outputs(cars_all, ii, output_mode, time_new, time_start);
+			do_outputs(cars_all, seq, output_mode, time_new, time_start);
+			if (output_mode > 1) {
+				logger.log(cars_all, time_new, time_start);
+			}
 		}
+		double tick_output = cv::getTickCount();
+		stats.record(STAGE_OUTPUTS, tick, tick_output);
 		
-		// Update JSON output with new data
-		do_json(cars_all, sock, output_mode, time_new);
+		// Send new data to local readers and the controller
+		shm_writer.write_state(cars_all, seq, time_new);
+		stats.count(publisher.publish(cars_all, seq, output_mode, time_new, time_capture));
+		double tick_json = cv::getTickCount();
+		stats.record(STAGE_JSON, tick_output, tick_json);
+		stats.record(STAGE_LATENCY, time_read, tick_json);
+		n_published++;
 		
-		// Update "old" data values
-		time_old = time_new;
-		for (int jj = 0; jj < cars_all.size(); jj++) {
-			cars_all[jj].new_to_old();
+		// Latency statistics, periodically and on request
+		if (config.stats_interval > 0 && n_published % config.stats_interval == 0) {
+			cout << endl << "Latency after " << n_published << " frames:" << endl;
+			print_stats(stdout);
 		}
-		
-		// Small delay to ensure comms can keep up
-		usleep(delay*1000);
+		if (stats_requested) {
+			stats_requested = 0;
+			FILE *f = fopen("stats.txt", "w");
+			if (f != NULL) {
+				print_stats(f);
+				fclose(f);
+			}
+		}
+	}
+	for (int i = 0; i < n_cameras; i++) {
+		workers[i]->join();
 	}
+	control.close_control();
+	delete tuning.exchange(NULL);
+	retired.free_all();
+	logger.close_log();
+	publisher.close_publisher();
+	shm_writer.close_writer();
 	
 	double time_total = double ( cv::getTickCount() - time_start ) / double ( cv::getTickFrequency() ); // total time in seconds
 	cout << endl;
 	cout << "Total time: " << time_total <<" seconds"<<endl;
-	cout << "Total frames: " << n_frames <<endl;
-    cout << "Average processing speed: " << time_total/n_frames*1000 << " ms/frame (" << n_frames/time_total<< " fps)" <<endl;
+	for (int i = 0; i < n_cameras; i++) {
+		long n_captured = workers[i]->frames.pushed;
+		if (n_cameras > 1) cout << "Camera " << i + 1 << ":" << endl;
+		cout << "Total frames: " << n_captured <<endl;
+		cout << "Dropped frames: " << workers[i]->frames.dropped << " before detection, " << workers[i]->results.dropped << " before merging" <<endl;
+		cout << "Average processing speed: " << time_total/n_captured*1000 << " ms/frame (" << n_captured/time_total<< " fps)" <<endl;
+		const MotionGate &gate = workers[i]->gate;
+		if (gate.tile > 0 && gate.n_tiles > 0) {
+			cout << "Motion gating: " << 100.0*gate.n_classified/gate.n_tiles << "% of tiles classified, " << workers[i]->n_reused << " measurements reused" <<endl;
+		}
+		const Association &association = workers[i]->association;
+		cout << "Association: " << association.n_ambiguous << " cars with several candidates, " << association.n_shared
+			<< " blobs matching several cars, " << association.n_gated << " candidates outside the gate" <<endl;
+	}
+	cout << "Published: " << n_published << " updates" <<endl;
+	cout << "Latency:" <<endl;
+	print_stats(stdout);
 	
-	Camera.release();
+	for (int i = 0; i < n_cameras; i++) {
+		workers[i]->close_worker();
+		delete workers[i];
+	}
 	
 	return 0;
 }
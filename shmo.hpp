@@ -1,17 +1,344 @@
+// Header include guard
+#ifndef SHMO_H	// if shmo.h has not been included, include it, otherwise do not
+#define SHMO_H	// see end of file for corresponding #endif
+
 // OpenCV and camera interfacing includes
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv/highgui.h"
 
+// SIMD includes
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "common.hpp"
+#include "logger.hpp"
+#include "blobs.hpp"
+#include "parallel.hpp"
 
 // Namespaces
 using namespace std;
 using namespace cv;
 
+// Hue matching definitions:
+#define SAT_MIN		40		// minimum saturation for a pixel to match a car
+#define VAL_MIN		40		// minimum value (brightness) for a pixel to match a car
+#define LUT_BITS	6		// bits kept per BGR channel when indexing the car lookup table (6 bits -> 256 kB table)
+#define CLASSIFY_ROWS	4	// scratch rows needed by do_classify
+#define DECIMATE_SLACK	2	// factor by which a decimated blob's scaled area may be outside a car's size range
+#define MAX_CANDIDATES	8	// candidates kept for one car in one search (the most plausible, see add_candidate)
+#define CHROMA_MIN	30		// minimum chroma (max - min of R, G, B) for an I420 pixel to match a car
+#define LUMA_MIN	40		// minimum luma (Y) for an I420 pixel to match a car
+
+
+void do_lut(const vector<Car> &cars_all, vector<uchar> &lut)
+// This function builds the lookup table used by do_classify to map a BGR pixel straight to the cars it matches
+// Each entry is a bitmask of cars (bit i set for cars_all[i]) for one quantised BGR colour
+// Each LUT_BITS-bit bin of colours is classified by its centre, converted using OpenCV's own BGR to HSV conversion and
+// tested against each car's hue range and the SAT_MIN/VAL_MIN floors as do_mask tests individual pixels. Every pixel of
+// the bin gets the centre's result, so pixels near a hue, SAT_MIN or VAL_MIN edge can differ from do_mask
+{
+	int n_entries = 1 << (3*LUT_BITS);
+	int levels = 1 << LUT_BITS;			// quantised levels per channel
+	int bin = 1 << (8 - LUT_BITS);		// width of each quantised level
+	
+	// One pixel per table entry, at the centre of its quantisation bin
+	Mat bgr(1, n_entries, CV_8UC3);
+	for (int i = 0; i < n_entries; i++) {
+		Vec3b &px = bgr.at<Vec3b>(0, i);
+		px[0] = ((i >> (2*LUT_BITS)) & (levels - 1))*bin + bin/2;	// blue
+		px[1] = ((i >> LUT_BITS) & (levels - 1))*bin + bin/2;		// green
+		px[2] = (i & (levels - 1))*bin + bin/2;						// red
+	}
+	Mat hsv;
+	cvtColor(bgr, hsv, COLOR_BGR2HSV);
+	
+	// Test each colour against every car
+	lut.assign(n_entries, 0);
+	for (int i = 0; i < n_entries; i++) {
+		const Vec3b &px = hsv.at<Vec3b>(0, i);
+		if (px[1] < SAT_MIN || px[2] < VAL_MIN) continue;
+		for (int jj = 0; jj < cars_all.size(); jj++) {
+			if (px[0] >= cars_all[jj].hue - cars_all[jj].delta && px[0] <= cars_all[jj].hue + cars_all[jj].delta) {
+				lut[i] |= 1 << jj;
+			}
+		}
+	}
+	
+	return;
+}
+
+
+inline float hue_cv(float r, float g, float b)
+// Hue of a colour in OpenCV's 8-bit units (0-180, not rounded), as its BGR to HSV conversion computes it
+// r, g and b may be channel values or colour differences (only their differences matter)
+{
+	float c_max = max(r, max(g, b)), c_min = min(r, min(g, b));
+	float chroma = c_max - c_min;
+	if (chroma <= 0) return 0;
+	float hue;
+	if (c_max == r) {
+		hue = 60*(g - b)/chroma;
+	} else if (c_max == g) {
+		hue = 120 + 60*(b - r)/chroma;
+	} else {
+		hue = 240 + 60*(r - g)/chroma;
+	}
+	if (hue < 0) hue += 360;
+	return hue/2;
+}
+
+
+void do_lut_uv(const vector<Car> &cars_all, vector<uchar> &lut)
+// This function builds the lookup table used by do_classify for I420 frames, mapping a chroma pair (U, V) straight to
+// the cars it matches (entry (U << 8) | V is a bitmask of cars, bit i set for cars_all[i])
+// Hue only depends on chroma: R - Y, G - Y and B - Y are linear in U and V (BT.601), so the hue angle OpenCV's HSV
+// conversion would give is computed from them directly. The magnitude test (CHROMA_MIN) stands in for SAT_MIN and
+// do_classify applies LUMA_MIN in place of VAL_MIN.
+{
+	lut.assign(1 << 16, 0);
+	for (int u = 0; u < 256; u++) {
+		for (int v = 0; v < 256; v++) {
+			// Colour differences (full range BT.601, video range only scales them, which leaves the hue unchanged)
+			float r = 1.402f*(v - 128);
+			float g = -0.344136f*(u - 128) - 0.714136f*(v - 128);
+			float b = 1.772f*(u - 128);
+			float chroma = max(r, max(g, b)) - min(r, min(g, b));
+			if (chroma < CHROMA_MIN) continue;
+			
+			// Hue in OpenCV's 8-bit units (0-180)
+			int hue = cvRound(hue_cv(r, g, b));
+			
+			for (int jj = 0; jj < cars_all.size(); jj++) {
+				if (hue >= cars_all[jj].hue - cars_all[jj].delta && hue <= cars_all[jj].hue + cars_all[jj].delta) {
+					lut[(u << 8) | v] |= 1 << jj;
+				}
+			}
+		}
+	}
+	
+	return;
+}
+
+
+inline void or3_row(const uchar *a, const uchar *b, const uchar *c, uchar *out, int n)
+// out[i] = a[i] | b[i] | c[i] for n bytes, vectorised where the instruction set allows (compile with -DNO_SIMD for
+// the scalar reference version)
+{
+	int i = 0;
+#if !defined(NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+	for (; i + 16 <= n; i += 16) {
+		vst1q_u8(out + i, vorrq_u8(vorrq_u8(vld1q_u8(a + i), vld1q_u8(b + i)), vld1q_u8(c + i)));
+	}
+#elif !defined(NO_SIMD) && defined(__AVX2__)
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(b + i)));
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_or_si256(v, _mm256_loadu_si256((const __m256i *)(c + i))));
+	}
+#elif !defined(NO_SIMD) && defined(__SSE2__)
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(v, _mm_loadu_si128((const __m128i *)(c + i))));
+	}
+#endif
+	for (; i < n; i++) {
+		out[i] = a[i] | b[i] | c[i];
+	}
+	return;
+}
+
+
+inline void and_row(uchar *out, const uchar *mask, int n)
+// out[i] &= mask[i] for n bytes, vectorised as or3_row is
+{
+	int i = 0;
+#if !defined(NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+	for (; i + 16 <= n; i += 16) {
+		vst1q_u8(out + i, vandq_u8(vld1q_u8(out + i), vld1q_u8(mask + i)));
+	}
+#elif !defined(NO_SIMD) && defined(__SSE2__)
+	for (; i + 16 <= n; i += 16) {
+		_mm_storeu_si128((__m128i *)(out + i), _mm_and_si128(_mm_loadu_si128((const __m128i *)(out + i)), _mm_loadu_si128((const __m128i *)(mask + i))));
+	}
+#endif
+	for (; i < n; i++) {
+		out[i] &= mask[i];
+	}
+	return;
+}
+
+
+void do_classify(Mat src, Mat labels, Mat rows, const vector<uchar> &lut, int crop, Rect region, int step = 1, Mat keep = Mat())
+// This function labels every pixel of a BGR image with the cars whose hue it matches, in a single pass for all cars
+// This replaces the HSV conversion and the per-car do_mask calls
+// The lookup, border crop and 3x3 dilation are fused: source rows are streamed through a rolling window of three
+// horizontally dilated rows, and each output row is written once as soon as the row below it is available
+// src		BGR source image, or an I420 frame (CV_8UC1 with height*3/2 rows, see frame_source.hpp)
+// labels	output label image (CV_8UC1, source image dimensions divided by step), bit i set where cars_all[i] matches
+// rows		scratch rows (CV_8UC1, at least CLASSIFY_ROWS rows of labels.cols + 2)
+// lut		lookup table built by do_lut (BGR) or do_lut_uv (I420)
+// crop		is number of pixels that should be removed from each edge (to ignore the wooden frame border)
+// region	part of labels to compute (pixels outside it are left untouched)
+// step		decimation factor: label (x, y) is looked up from source pixel (step*x, step*y)
+//			I420 frames are labelled from their quarter-size chroma planes, so step must be even (2 for chroma resolution)
+// keep		static exclusion mask (see static_mask.hpp, same size as labels), the car bits allowed at each pixel are
+//			kept after the dilation; empty to keep every label
+{
+	int shift = 8 - LUT_BITS;
+	bool i420 = src.type() == CV_8UC1;
+	int height = i420 ? src.rows*2/3 : src.rows;	// source image height
+	
+	// Pixels within one of region are needed for the dilation
+	Rect ext = Rect(region.x - 1, region.y - 1, region.width + 2, region.height + 2) & Rect(0, 0, labels.cols, labels.rows);
+	int x_start = max(ext.x, (crop + step - 1)/step), x_end = min(ext.x + ext.width - 1, (src.cols - crop)/step);	// crop rectangle
+	int y_start = max(ext.y, (crop + step - 1)/step), y_end = min(ext.y + ext.height - 1, (height - crop)/step);	// bounds (same
+	// as the filled rectangle in do_mask, in label coordinates)
+	
+	// I420 plane layout (the U and V planes are half the width and height of the Y plane and follow it)
+	int chroma_step = step/2;
+	const uchar *plane_u = src.data + (size_t)src.cols*height;
+	size_t plane_bytes = (size_t)(src.cols/2)*(height/2);
+	
+	// Scratch rows: looked-up labels (with a zero either side) and a ring of three horizontally dilated rows
+	uchar *raw = rows.ptr<uchar>(0);
+	uchar *dilated[3] = {rows.ptr<uchar>(1), rows.ptr<uchar>(2), rows.ptr<uchar>(3)};
+	raw[0] = 0;
+	raw[ext.width + 1] = 0;
+	
+	for (int y = ext.y; y < ext.y + ext.height; y++) {
+		// Look up the row (zero outside the crop rectangle)
+		memset(raw + 1, 0, ext.width);
+		if (y >= y_start && y <= y_end && i420) {
+			const uchar *luma = src.ptr<uchar>(y*step) + step*x_start;
+			const uchar *u = plane_u + (size_t)(y*chroma_step)*(src.cols/2) + chroma_step*x_start;
+			const uchar *v = u + plane_bytes;
+			uchar *out = raw + 1 - ext.x;
+			for (int x = x_start; x <= x_end; x++, luma += step, u += chroma_step, v += chroma_step) {
+				out[x] = *luma >= LUMA_MIN ? lut[(*u << 8) | *v] : 0;
+			}
+		} else if (y >= y_start && y <= y_end) {
+			const uchar *px = src.ptr<uchar>(y*step) + 3*step*x_start;
+			uchar *out = raw + 1 - ext.x;
+			for (int x = x_start; x <= x_end; x++, px += 3*step) {
+				out[x] = lut[((px[0] >> shift) << (2*LUT_BITS)) | ((px[1] >> shift) << LUT_BITS) | (px[2] >> shift)];
+			}
+		}
+		
+		// Horizontal dilation into the ring
+		or3_row(raw, raw + 1, raw + 2, dilated[y % 3], ext.width);
+		
+		// Vertical dilation of the row above, now that its neighbours are available
+		int y_out = y - 1;
+		if (y_out >= region.y && y_out < region.y + region.height) {
+			const uchar *above = dilated[(y_out > 0 ? y_out - 1 : y_out) % 3];
+			int off = region.x - ext.x;
+			or3_row(above + off, dilated[y_out % 3] + off, dilated[y % 3] + off, labels.ptr<uchar>(y_out) + region.x, region.width);
+			if (keep.data != NULL) and_row(labels.ptr<uchar>(y_out) + region.x, keep.ptr<uchar>(y_out) + region.x, region.width);
+		}
+	}
+	
+	// Last row of the region when it is also the last row of the image (nothing below it)
+	int y_last = region.y + region.height - 1;
+	if (y_last == labels.rows - 1) {
+		const uchar *above = dilated[(y_last > 0 ? y_last - 1 : y_last) % 3];
+		int off = region.x - ext.x;
+		or3_row(above + off, dilated[y_last % 3] + off, dilated[y_last % 3] + off, labels.ptr<uchar>(y_last) + region.x, region.width);
+		if (keep.data != NULL) and_row(labels.ptr<uchar>(y_last) + region.x, keep.ptr<uchar>(y_last) + region.x, region.width);
+	}
+	
+	return;
+}
+
+
+// do_classify split into horizontal stripes of the region and run on a stripe pool
+// Each stripe reads the source rows either side of it for the dilation (as do_classify does for any region) and writes
+// only its own label rows, so the stripes are independent and the labels identical to a single call
+struct ClassifyStripes : StripeJob {
+	Mat rows;					// scratch rows for each stripe (CLASSIFY_ROWS per stripe)
+	Mat src, labels;			// arguments of the current call (see do_classify)
+	const vector<uchar> *lut;
+	int crop, step;
+	Rect region;
+	Mat keep;					// static exclusion mask (empty for none)
+	
+	ClassifyStripes() : lut(NULL), crop(0), step(1) {}
+	
+	void open_stripes(int width, int n_threads)
+	// Allocate scratch rows for up to n_threads stripes of a label image width pixels wide
+	{
+		rows = Mat::zeros(CLASSIFY_ROWS*n_threads, width + 2, CV_8UC1);
+		return;
+	}
+	
+	void classify(StripePool *pool, Mat src_, Mat labels_, const vector<uchar> &lut_, int crop_, Rect region_, int step_ = 1,
+		Mat keep_ = Mat())
+	// Label region as do_classify does, one stripe per thread of pool (serially if pool is NULL or the region is small)
+	{
+		src = src_;
+		labels = labels_;
+		lut = &lut_;
+		crop = crop_;
+		region = region_;
+		step = step_;
+		keep = keep_;
+		int n_stripes = stripes_for(pool, region.height);
+		if (n_stripes == 1) {
+			run(0, 1);
+		} else {
+			pool->run(*this, n_stripes);
+		}
+		return;
+	}
+	
+	void run(int stripe, int n_stripes)
+	// Label one stripe of the region (on a pool thread)
+	{
+		int y_begin = region.y + stripe_start(region.height, stripe, n_stripes);
+		int y_end = region.y + stripe_start(region.height, stripe + 1, n_stripes);
+		do_classify(src, labels, rows(Rect(0, stripe*CLASSIFY_ROWS, rows.cols, CLASSIFY_ROWS)), *lut, crop,
+			Rect(region.x, y_begin, region.width, y_end - y_begin), step, keep);
+		return;
+	}
+};
+
+void do_roi(Car &car, const Config &config, Size size, int frame, double time_new)
+// This function chooses the region of the image searched for a car in the current frame
+// The car's estimated position and velocity (see do_track) are used to predict where it is now and a window is placed
+// around this. The full frame is searched if tracking is disabled, the car was missed or a periodic re-acquire is due
+// The prediction is kept in car.position_pred for associating candidates with the car (see associate.hpp)
+{
+	Rect full(0, 0, size.width, size.height);
+	
+	// Predict position (converting from mm back to pixels)
+	if (car.n_tracked > 0) {
+		double time_inc = double (time_new - car.time_est) / double (cv::getTickFrequency());
+		car.position_pred[0] = (car.position_est[0] + car.velocity_est[0]*time_inc)/config.scale + config.origin[0];
+		car.position_pred[1] = (car.position_est[1] + car.velocity_est[1]*time_inc)/config.scale + config.origin[1];
+	}
+	
+	if (config.roi_size < 1 || car.n_tracked < 1 || car.n_coast > 0 || (config.roi_reacquire > 0 && frame % config.roi_reacquire == 0)) {
+		car.roi = full;
+		return;
+	}
+	
+	// Window around predicted position, limited to the image
+	int half = config.roi_size/2 + config.roi_margin;
+	car.roi = Rect(cvRound(car.position_pred[0]) - half, cvRound(car.position_pred[1]) - half, 2*half + 1, 2*half + 1) & full;
+	if (car.roi.area() == 0) {
+		// Prediction has left the image
+		car.roi = full;
+	}
+	
+	return;
+}
+
 
 void do_mask(Mat hsv, Mat mask, int mid_hue, int delta, int crop, string name)
 // This function derives a hue-based mask from a given HSV image
+// Note: the tracking loop uses do_classify instead - this per-car version is kept as the reference hue test
 // hsv and mask must have the same dimensions
 // mid_hue 	is the middle (expected peak) hue value associated with the desired object
 // delta 	is the expected range either side of the peak value that should be included
@@ -19,7 +346,7 @@ void do_mask(Mat hsv, Mat mask, int mid_hue, int delta, int crop, string name)
 // name		chosen identifier for each car
 {
 	// Initial hue matching operation
-	inRange(hsv, Scalar(mid_hue - delta, 40, 40), Scalar(mid_hue + delta, 255, 255), mask);
+	inRange(hsv, Scalar(mid_hue - delta, SAT_MIN, VAL_MIN), Scalar(mid_hue + delta, 255, 255), mask);
 	
 	// Cropping mask
 	Mat mask_crop = Mat::zeros(hsv.rows, hsv.cols, CV_8UC1);	// declare mask used to eliminate table borders
@@ -31,89 +358,216 @@ void do_mask(Mat hsv, Mat mask, int mid_hue, int delta, int crop, string name)
 	// Apply dilation to remove holes and smooth out edges
 	int dilation_iterations = 1;	// number of iterations to compute
 	int dilation_size = 3;			// size of rectangular kernel
-	Mat element = getStructuringElement(MORPH_RECT, Size(dilation_size, dilation_size), Point(-1, -1));		// dilation kernel element
+	static const Mat element = getStructuringElement(MORPH_RECT, Size(dilation_size, dilation_size), Point(-1, -1));	// dilation kernel element (built once)
 	dilate(mask, mask, element, Point(-1, -1), dilation_iterations);
 	
 	return;
 }
 
 
-void find_car(Mat mask, Car &car)
-// This function locates a desired car in a given mask and determines its centroid.
-// The centroid is then stored in the car's associated structure.
-// mask		binary image showing hues matching to car of interest
-// car		structure for car of interest
-{	
-	// Create mask that can be modified without affecting original
-	Mat mask_use = Mat::zeros(mask.rows, mask.cols, CV_8UC1);
-	mask.copyTo(mask_use);
-	
-	// Find contours
-	vector<vector<Point> > contours;								// vector for storing contours
-	findContours(mask_use, contours, RETR_LIST, CHAIN_APPROX_SIMPLE);	// note that contours is modified in this step
-	int n_contours = contours.size();								// number of contours
-	
-	// Return an error state if no contours, and hence no cars, are found
-	if (n_contours < 1)
-	{
+// Blob that may be a car (within the car's size range), in full image pixels
+struct Candidate {
+	int car;					// index of the car whose label bit the blob was found in
+	float x, y;					// centroid
+	float area;
+	Rect box;					// bounding box
+	float cost;					// association cost (see associate.hpp)
+};
+
+
+void set_measurement(Car &car, const Candidate *found)
+// Store a candidate as the car's measurement, or the error state if found is NULL (no car found)
+{
+	if (found == NULL) {
 		car.position_new[0] = 0;
 		car.position_new[1] = 0;
 		car.area_new = -1;
+		car.blob = Rect();
 		return;
 	}
-	
-	// Contour areas
-	float contour_areas [n_contours];
-	for (int i = 0; i < n_contours; i++)
-	{
-		contour_areas[i] = contourArea(contours[i]);
+	car.position_new[0] = found->x;		// x-position of car in pixels along x-axis from origin
+	car.position_new[1] = found->y;		// y-position of car in pixels along y-axis from origin
+	car.area_new = found->area;
+	car.blob = found->box;
+	return;
+}
+
+
+Candidate make_candidate(const Blob &blob, int car_index, int step)
+// Candidate of a car measured from a blob of a label image decimated by step (see do_classify), in full image pixels
+// Each label covers step x step pixels, so the centroid is moved to the middle of the block it stands for
+{
+	Candidate c;
+	c.car = car_index;
+	c.x = blob.x()*step + (step - 1)/2.0f;
+	c.y = blob.y()*step + (step - 1)/2.0f;
+	c.area = blob.area()*step*step;
+	c.box = Rect(blob.x_min*step, blob.y_min*step, (blob.x_max - blob.x_min + 1)*step, (blob.y_max - blob.y_min + 1)*step);
+	c.cost = 0;
+	return c;
+}
+
+
+float candidate_rank(const Car &car, const Candidate &c)
+// How unlikely a candidate is to be the car (lower is better): its distance from the car's prediction if the car is
+// tracked, otherwise how far its area is from the middle of the car's size range
+{
+	if (car.n_tracked > 0) {
+		float dx = c.x - car.position_pred[0], dy = c.y - car.position_pred[1];
+		return dx*dx + dy*dy;
+	}
+	return fabs(c.area - (car.size_min + car.size_max)/2.0f);
+}
+
+
+void add_candidate(vector<Candidate> &candidates, int first, const Candidate &c, const Car &car, long &n_overflow)
+// Add one of a car's candidates (the car's start at candidates[first]), keeping at most MAX_CANDIDATES of them
+// Once the car has MAX_CANDIDATES the least plausible (candidate_rank) is dropped and counted in n_overflow, so a frame
+// full of distractors neither pushes other cars' candidates out nor grows candidates past the space reserved for it
+{
+	if (candidates.size() - first < MAX_CANDIDATES) {
+		candidates.push_back(c);
+		return;
+	}
+	n_overflow++;
+	int worst = first;
+	for (int k = first + 1; k < candidates.size(); k++) {
+		if (candidate_rank(car, candidates[k]) > candidate_rank(car, candidates[worst])) worst = k;
 	}
+	if (candidate_rank(car, c) < candidate_rank(car, candidates[worst])) candidates[worst] = c;
+	return;
+}
+
+
+int find_candidates(Mat labels, int car_bit, int car_index, const Car &car, Point offset, BlobFinder &finder,
+	vector<Candidate> &candidates, long &n_overflow, int step = 1)
+// This function adds the blobs of a car's bit that fit the car's size range to candidates (at most MAX_CANDIDATES,
+// see add_candidate, with the blobs left out counted in n_overflow), returns how many it added
+// labels	label image from do_classify (or the part of it being searched)
+// car_bit	bit of the label image belonging to the car of interest, car_index the car's index in cars_all
+// offset	position of labels within the full image, so centroids are in full image coordinates
+// finder	blob extractor (reused between calls so no buffers are allocated)
+// step		decimation of labels (see do_classify), areas and centroids are scaled back to full resolution
+{
+	// Find connected blobs of the car's hue (in one scan of the label image)
+	finder.find(labels, car_bit, offset);
 	
-	// Check areas against known vehicle size and hence locate vehicles
-	int contour_idx;	// index of contour that correspond to desired vehicle
-	int idx = 0;		// counter
-	for (int i = 0; i < n_contours; i++)	// scan through contour areas
+	// Check areas against known vehicle size
+	int first = candidates.size();	// this car's candidates start here
+	for (int i = 0; i < finder.blobs.size(); i++)	// scan through blob areas
 	{
-		if (contour_areas[i] > car.size_min && contour_areas[i] < car.size_max) 	// compare area to low and high thresholds
+		float area = finder.blobs[i].area()*step*step;
+		if (area > car.size_min && area < car.size_max) 	// compare area to low and high thresholds
 		{
-			contour_idx = i;	// if area within thresholds, record contour index
-			idx++;				// increment index - used later to check only one car was found
+			add_candidate(candidates, first, make_candidate(finder.blobs[i], car_index, step), car, n_overflow);
 		}
 	}
+	return candidates.size() - first;
+}
+
+
+void find_car(Mat labels, int car_bit, Car &car, Point offset, BlobFinder &finder, int step = 1)
+// This function locates a desired car in a given label image and determines its centroid.
+// The centroid is then stored in the car's associated structure.
+// If several blobs fit the car's size range the last one is used: the tracker itself collects every candidate
+// (find_candidates) and chooses between them with the other cars' in associate.hpp
+// Arguments as find_candidates
+{
+	// Find connected blobs of the car's hue (in one scan of the label image)
+	finder.find(labels, car_bit, offset);
 	
-	// Display a warning if more than one object fitting the size and colour requirements is found.
-	if (idx > 1)
+	// Check areas against known vehicle size and hence locate vehicles
+	int blob_idx = -1;	// index of blob that corresponds to desired vehicle
+	for (int i = 0; i < finder.blobs.size(); i++)	// scan through blob areas
 	{
-		cout<<"WARNING: more than one object resembling the "<< car.name <<" car was found."<<endl;
-		cout<<"Using the last object found for calculations. Check masks to verify this is correct."<<endl;
+		float area = finder.blobs[i].area()*step*step;
+		if (area > car.size_min && area < car.size_max) 	// compare area to low and high thresholds
+		{
+			blob_idx = i;		// if area within thresholds, record blob index
+		}
 	}
 	
-	// Return an error state if no contours match area requirements and hence no car is found
-	if (idx == 0)
+	// Return an error state if no blobs match area requirements and hence no car is found
+	if (blob_idx < 0)
 	{
-		car.position_new[0] = 0;
-		car.position_new[1] = 0;
-		car.area_new = -1;
+		set_measurement(car, NULL);
 		return;
 	}
 
-	// Determine vehicle centroids, car position and object area
-	Moments mu;
-	mu = moments(contours[contour_idx], true);		// moment of car's contour		
-	car.position_new[0] = mu.m10 / mu.m00;	// x-position of car in pixels along x-axis from origin
-	car.position_new[1] = mu.m01 / mu.m00;	// y-position of car in pixels along y-axis from origin
-	car.area_new = contour_areas[contour_idx];
+	// Car position (blob centroid) and object area
+	Candidate found = make_candidate(finder.blobs[blob_idx], 0, step);
+	set_measurement(car, &found);
 	
 	return;
 }
 
 
-void do_debug (const vector<Car> cars_all, const Mat src, const vector<Mat> masks_all, int frame, int output_mode, double time_new, double time_start)
+Rect scale_rect(Rect r, int step)
+// Rectangle of a label image decimated by step that covers rectangle r of the full image
+{
+	return Rect(r.x/step, r.y/step, (r.x + r.width + step - 1)/step - r.x/step, (r.y + r.height + step - 1)/step - r.y/step);
+}
+
+
+int find_candidates_decimated(Mat src, Mat labels, Mat labels_small, Mat rows, const vector<uchar> &lut, int crop, int step,
+	int car_bit, int car_index, const Car &car, BlobFinder &finder, BlobFinder &finder_fine, vector<Candidate> &candidates,
+	long &n_overflow, Mat keep = Mat())
+// Multi-resolution version of find_candidates: blobs are found in a label image decimated by step (see do_classify),
+// then each plausible one is labelled again and measured at full resolution in a window around it
+// The coarse area test is loose (a factor of DECIMATE_SLACK either side of the scaled size range) as decimation and
+// dilation distort small blobs; the full-resolution area decides, with the same thresholds as find_candidates
+// src			BGR source image
+// labels		full resolution label image (only the windows around candidates are written)
+// labels_small	decimated label image, already classified over car.roi (scaled to it)
+// rows			scratch rows for do_classify
+// finder		blob extractor for the decimated image, finder_fine for the full resolution windows
+// keep			full resolution static exclusion mask (see do_classify), empty for none
+{
+	Rect full(0, 0, src.cols, src.rows);
+	Rect roi_small = scale_rect(car.roi, step) & Rect(0, 0, labels_small.cols, labels_small.rows);
+	float area_scale = step*step;
+	
+	// Coarse search
+	finder.find(labels_small(roi_small), car_bit, roi_small.tl());
+	
+	// Refine each candidate at full resolution
+	int first = candidates.size();	// this car's candidates start here
+	for (int i = 0; i < finder.blobs.size(); i++)
+	{
+		const Blob &coarse = finder.blobs[i];
+		float area = coarse.area()*area_scale;
+		if (area < car.size_min/DECIMATE_SLACK || area > car.size_max*DECIMATE_SLACK) continue;
+		
+		// Window around the candidate (a margin of two decimated pixels covers detail missed between samples)
+		Rect window = Rect((coarse.x_min - 2)*step, (coarse.y_min - 2)*step, (coarse.x_max - coarse.x_min + 5)*step,
+			(coarse.y_max - coarse.y_min + 5)*step) & full;
+		do_classify(src, labels, rows, lut, crop, window, 1, keep);
+		finder_fine.find(labels(window), car_bit, window.tl());
+		for (int j = 0; j < finder_fine.blobs.size(); j++)
+		{
+			const Blob &b = finder_fine.blobs[j];
+			area = b.area();
+			if (area <= car.size_min || area >= car.size_max) continue;		// compare area to thresholds
+			
+			// Skip a blob already found from an overlapping window
+			bool seen = false;
+			for (int k = first; k < candidates.size() && !seen; k++) seen = candidates[k].box == b.box();
+			if (seen) continue;
+			
+			add_candidate(candidates, first, make_candidate(b, car_index, 1), car, n_overflow);
+		}
+	}
+	return candidates.size() - first;
+}
+
+
+void do_debug (const vector<Car> &cars_all, const Mat src, const Mat labels, Logger &logger, int frame, int output_mode, double time_new, double time_start)
 // Save image outputs in addition to all other outputs
 // Note that the debug mode is algorithm-specific, and therefore not in common.hpp
 {
 	// Call normal outputs function in mode 3 (console + csv)
 	do_outputs(cars_all, frame, output_mode, time_new, time_start);
+	logger.log(cars_all, time_new, time_start);
 	
 	// Source + centroids image
 	// char filename [50];
@@ -121,12 +575,15 @@ void do_debug (const vector<Car> cars_all, const Mat src, const vector<Mat> mask
 	// imwrite(filename, src);
 	
 	// Mask images
-	// for (int i = 0; i < masks_all.size(); i++)
+	// for (int i = 0; i < cars_all.size(); i++)
 	// {
 		// sprintf(filename, "%03i_mask_%s.png", frame, cars_all[i].name.c_str());
-		// imwrite(filename, masks_all[i]);
+		// imwrite(filename, (labels & Scalar(1 << i)) != 0);
 	// }
 	
 	return;
 }
 
+
+
+#endif
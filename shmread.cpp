@@ -0,0 +1,47 @@
+// Prints the car states the tracker writes to shared memory (see shm_state.hpp), as an example reader
+// Usage: ./shmread [segment (default /shmo_state)] [readings (default 10)] [interval in ms (default 100)]
+
+// General includes
+#include <stdio.h>		// printf
+#include <stdlib.h>		// atoi
+#include <unistd.h>		// usleep
+
+#include "shm_state.hpp"	// shared-memory state block
+
+int main(int argc, char **argv)
+{
+	const char *name = argc > 1 ? argv[1] : "/shmo_state";
+	int n_readings = argc > 2 ? atoi(argv[2]) : 10;
+	int interval = argc > 3 ? atoi(argv[3]) : 100;
+
+	ShmReader reader;
+	if (!shm_open_reader(&reader, name)) {
+		printf("Error: could not open shared-memory state block %s (is the tracker running with shm_name set?)\n", name);
+		return 1;
+	}
+
+	ShmState state;
+	for (int i = 0; i < n_readings; i++) {
+		if (i > 0) usleep(interval*1000);
+		if (!shm_read_state(&reader, &state)) {
+			printf("No state written yet\n");
+			continue;
+		}
+		if (!state.writer_active) {
+			printf("Tracker has stopped\n");
+			break;
+		}
+		printf("frame %llu  time %7.3f s\n", (unsigned long long)state.frame, state.time);
+		for (int j = 0; j < (int)state.n_cars; j++) {
+			const ShmCar &car = state.cars[j];
+			if (!car.found) {
+				printf("  %-8s not detected\n", car.name);
+				continue;
+			}
+			printf("  %-8s (%6.1f, %6.1f) mm  (%6.1f, %6.1f) mm/s  %3i deg%s\n", car.name, car.position[0], car.position[1],
+				car.velocity[0], car.velocity[1], car.orientation, car.n_coast > 0 ? "  (predicted)" : "");
+		}
+	}
+	shm_close_reader(&reader);
+	return 0;
+}
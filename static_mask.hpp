@@ -0,0 +1,183 @@
+// Header include guard
+#ifndef STATIC_MASK_H	// if static_mask.h has not been included, include it, otherwise do not
+#define STATIC_MASK_H	// see end of file for corresponding #endif
+
+// General includes
+#include <iostream>		// cout
+#include <vector>		// vector
+#include <math.h>		// ceil
+
+// OpenCV includes
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"	// imread, imwrite
+
+#include "common.hpp"	// Obstacle
+#include "shmo.hpp"		// do_classify
+
+// Namespaces
+using namespace std;
+using namespace cv;
+
+// Static mask definitions:
+#define STATIC_PERSIST		0.5f	// share of the calibration frames a car must be labelled in at a pixel to exclude it
+#define STATIC_MAX_FRAMES	255		// most frames combined in a calibration (counts are one byte)
+
+
+// Static scene exclusion mask
+// Fixed objects within a car's hue range (furniture, tape, obstacles) would otherwise be labelled, traced and rejected
+// in every frame. The mask holds the car bits do_classify may keep at each pixel: bits seen in frames of the empty
+// arena are removed (calibration), and so is every bit inside an obstacle polygon. Only bits labelled in at least
+// STATIC_PERSIST of the calibration frames count as static, so sensor noise on the table is not excluded. The
+// calibration is cached in an image file (each pixel the bits of the cars excluded there, so it is black apart from the
+// distractors) and loaded at start up; obstacles are drawn from config.txt every time, so they can be edited without
+// calibrating again.
+// A calibration only holds for the hues it was made with, so calibrate again after retuning a car's hue or delta.
+struct StaticMask {
+	string path;				// file the calibration is cached in (empty to keep it in memory only)
+	int step;					// frame pixels per mask pixel (2 for I420 frames, labelled at chroma resolution)
+	int ratio;					// mask pixels per label pixel when searching a decimated image
+	Mat excluded;				// calibrated car bits excluded at each mask pixel
+	Mat obstacles;				// 255 inside an obstacle polygon
+	Mat scan;					// labels of the frame being calibrated from
+	vector<uchar> counts;		// frames each car was labelled in at each mask pixel (MAX_CARS per pixel)
+	Mat keep_buffer, keep_small_buffer;
+	Mat keep;					// car bits allowed at each mask pixel (no data if nothing is excluded)
+	Mat keep_small;				// keep reduced to the decimated label image (keep itself if not decimating)
+	int n_frames;				// frames combined in a calibration
+	int n_calibrate;			// frames still to combine, 0 when not calibrating
+
+	StaticMask() : step(1), ratio(1), n_frames(0), n_calibrate(0) {}
+
+	void open_mask(const string &file, Size size, int mask_step, int label_step, const vector<Obstacle> &obstacle_list,
+		float scale, const float origin[], int calibrate_frames)
+	// Allocate the mask for frames of the given size, draw the obstacles (world coordinates mapped to pixels with the
+	// camera's scale and origin) and load the cached calibration. If file is set but cannot be loaded, the first
+	// calibrate_frames frames are used to calibrate it (with none, only the obstacles are excluded).
+	{
+		path = file;
+		step = mask_step;
+		ratio = max(label_step/mask_step, 1);
+		int width = size.width/step, height = size.height/step;
+		excluded = Mat::zeros(height, width, CV_8UC1);
+		obstacles = Mat::zeros(height, width, CV_8UC1);
+		scan = Mat::zeros(height, width, CV_8UC1);
+		keep_buffer = Mat::zeros(height, width, CV_8UC1);
+		keep_small_buffer = ratio > 1 ? Mat::zeros(height/ratio, width/ratio, CV_8UC1) : keep_buffer;
+
+		// Obstacle polygons (mm -> pixels, the inverse of Car::px_to_mm)
+		vector<vector<Point> > polygons(obstacle_list.size());
+		for (int i = 0; i < obstacle_list.size(); i++) {
+			for (int j = 0; j < obstacle_list[i].points.size(); j++) {
+				const Point2f &p = obstacle_list[i].points[j];
+				polygons[i].push_back(Point(cvRound((p.x/scale + origin[0])/step), cvRound((p.y/scale + origin[1])/step)));
+			}
+		}
+		if (!polygons.empty()) fillPoly(obstacles, polygons, Scalar(255));
+
+		// Cached calibration
+		if (!path.empty()) {
+			Mat cached = imread(path, 0);	// as stored (one channel)
+			bool usable = cached.data != NULL && cached.cols == width && cached.rows == height && cached.type() == CV_8UC1;
+			if (!usable && calibrate_frames <= 0) {
+				cout << "WARNING: static mask " << path << " is missing or does not match the frames, only obstacles are excluded"
+					<< endl;
+			} else if (cached.data == NULL) {
+				cout << "WARNING: no static mask in " << path << ", calibrating it from the first " << calibrate_frames
+					<< " frames (the arena must be empty)" << endl;
+				start_calibration(calibrate_frames);
+			} else if (cached.cols != width || cached.rows != height || cached.type() != CV_8UC1) {
+				cout << "WARNING: static mask " << path << " does not match the frames, calibrating it again from the first "
+					<< calibrate_frames << " frames (the arena must be empty)" << endl;
+				start_calibration(calibrate_frames);
+			} else {
+				cached.copyTo(excluded);
+			}
+		}
+		build_keep();
+		return;
+	}
+
+	void start_calibration(int frames)
+	// Calibrate from the next frames frames (the mask in use is kept until the calibration is complete)
+	{
+		n_frames = min(max(frames, 1), STATIC_MAX_FRAMES);
+		n_calibrate = n_frames;
+		counts.assign((size_t)scan.rows*scan.cols*MAX_CARS, 0);
+		return;
+	}
+
+	bool calibrate(Mat src, Mat rows, const vector<uchar> &lut, int crop)
+	// Combine one frame of the empty arena into the calibration (nothing is done unless calibrating)
+	// Once enough frames are combined the calibration is swapped in and saved, and true is returned
+	// rows		scratch rows for do_classify (at least the frame width + 2)
+	{
+		if (n_calibrate == 0) return false;
+		do_classify(src, scan, rows, lut, crop, Rect(0, 0, scan.cols, scan.rows), step);
+		for (int y = 0; y < scan.rows; y++) {
+			const uchar *in = scan.ptr<uchar>(y);
+			uchar *count = &counts[(size_t)y*scan.cols*MAX_CARS];
+			for (int x = 0; x < scan.cols; x++, count += MAX_CARS) {
+				for (uchar bits = in[x]; bits != 0; bits &= bits - 1) count[__builtin_ctz(bits)]++;
+			}
+		}
+		if (--n_calibrate > 0) return false;
+
+		// Exclude the cars labelled persistently at each pixel
+		int n_persist = max((int)ceil(STATIC_PERSIST*n_frames), 1);
+		for (int y = 0; y < excluded.rows; y++) {
+			uchar *out = excluded.ptr<uchar>(y);
+			const uchar *count = &counts[(size_t)y*excluded.cols*MAX_CARS];
+			for (int x = 0; x < excluded.cols; x++, count += MAX_CARS) {
+				uchar bits = 0;
+				for (int i = 0; i < MAX_CARS; i++) {
+					if (count[i] >= n_persist) bits |= 1 << i;
+				}
+				out[x] = bits;
+			}
+		}
+		build_keep();
+		cout << "Static mask calibrated from " << n_frames << " frames: " << countNonZero(excluded)
+			<< " pixels excluded for at least one car" << endl;
+		if (!path.empty() && !imwrite(path, excluded)) {
+			cout << "Error: could not save static mask to " << path << endl;
+		}
+		return true;
+	}
+
+	void build_keep(void)
+	// Combine the calibration and the obstacles into the bits kept at each pixel (at mask and label resolution)
+	{
+		bool any = false;
+		for (int y = 0; y < excluded.rows; y++) {
+			const uchar *ex = excluded.ptr<uchar>(y);
+			const uchar *obstacle = obstacles.ptr<uchar>(y);
+			uchar *out = keep_buffer.ptr<uchar>(y);
+			for (int x = 0; x < excluded.cols; x++) {
+				out[x] = obstacle[x] ? 0 : (uchar)~ex[x];
+				any = any || out[x] != 0xff;
+			}
+		}
+
+		// A decimated label keeps a car bit only if every pixel it stands for does
+		if (ratio > 1) {
+			for (int y = 0; y < keep_small_buffer.rows; y++) {
+				uchar *out = keep_small_buffer.ptr<uchar>(y);
+				for (int x = 0; x < keep_small_buffer.cols; x++) {
+					uchar bits = 0xff;
+					for (int dy = 0; dy < ratio; dy++) {
+						const uchar *in = keep_buffer.ptr<uchar>(y*ratio + dy) + x*ratio;
+						for (int dx = 0; dx < ratio; dx++) bits &= in[dx];
+					}
+					out[x] = bits;
+				}
+			}
+		}
+		keep = any ? keep_buffer : Mat();
+		keep_small = any ? keep_small_buffer : Mat();
+		return;
+	}
+};
+
+
+
+#endif
@@ -0,0 +1,196 @@
+// Header include guard
+#ifndef STATS_H	// if stats.h has not been included, include it, otherwise do not
+#define STATS_H	// see end of file for corresponding #endif
+
+// General includes
+#include <stdio.h>		// fprintf
+#include <stdint.h>		// uint32_t, uint64_t
+#include <signal.h>		// sig_atomic_t
+#include <atomic>		// atomic
+
+// OpenCV includes
+#include "opencv2/imgproc/imgproc.hpp"	// getTickCount
+
+// Namespaces
+using namespace std;
+
+// Latency histogram definitions:
+#define HIST_SUB_BITS		4			// 16 buckets per power of two, i.e. values are recorded to within ~6%
+#define HIST_RANGES			36			// powers of two covered above the linear range (up to ~17 minutes in ns)
+#define HIST_BUCKETS		((HIST_RANGES + 1) << HIST_SUB_BITS)
+
+// Pipeline stages that are timed
+enum {
+	STAGE_GRAB,			// Camera.grab() (or reading a recorded frame)
+	STAGE_RETRIEVE,		// Camera.retrieve()
+	STAGE_CLASSIFY,		// do_classify (hue labelling, crop and dilation for all cars)
+	STAGE_FIND,			// find_car for all cars (blob extraction)
+	STAGE_OUTPUTS,		// do_outputs and queueing the log record
+	STAGE_JSON,			// Publisher::publish (formatting and send)
+	STAGE_LATENCY,		// frame capture to end of publishing
+	N_STAGES
+};
+const char *STAGE_NAMES[N_STAGES] = {"grab", "retrieve", "classify", "find", "outputs", "json", "latency"};
+
+// Publishing decisions that are counted (see Publisher::publish)
+enum {
+	COUNT_SENT,			// messages sent to the controller (or printed in debug mode)
+	COUNT_PACED,		// frames not sent because the target rate had already been reached (target_fps)
+	COUNT_BACKLOG,		// frames not sent because the controller had not read earlier messages (publish_backlog)
+	COUNT_BUSY,			// frames not sent because the previous message was still being written to the socket
+	N_COUNTS
+};
+const char *COUNT_NAMES[N_COUNTS] = {"sent", "paced", "backlog", "busy"};
+
+
+// Log-linear latency histogram (in the style of HDR histograms)
+// Values below 2^HIST_SUB_BITS ns have their own buckets, above that each power of two is split into 2^HIST_SUB_BITS
+// buckets. Each histogram has a single writing thread; counts are atomic so any thread can read a snapshot.
+struct Histogram {
+	atomic<uint32_t> counts[HIST_BUCKETS];
+	atomic<uint64_t> n;				// number of values recorded
+	atomic<uint64_t> max;			// largest value recorded (ns)
+
+	Histogram() : n(0), max(0) {
+		for (int i = 0; i < HIST_BUCKETS; i++) counts[i] = 0;
+	}
+
+	static int bucket(uint64_t ns)
+	// Bucket holding a value
+	{
+		if (ns < (1u << HIST_SUB_BITS)) return ns;
+		int shift = 63 - __builtin_clzll(ns) - HIST_SUB_BITS;
+		int idx = ((shift + 1) << HIST_SUB_BITS) + (int)((ns >> shift) - (1u << HIST_SUB_BITS));
+		return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+	}
+
+	static uint64_t bucket_value(int idx)
+	// Largest value held in a bucket
+	{
+		if (idx < (1 << HIST_SUB_BITS)) return idx;
+		int shift = (idx >> HIST_SUB_BITS) - 1;
+		uint64_t sub = idx & ((1 << HIST_SUB_BITS) - 1);
+		return (((1ull << HIST_SUB_BITS) + sub + 1) << shift) - 1;
+	}
+
+	void record(uint64_t ns)
+	// Add a value (single writer, so plain loads and stores are enough)
+	{
+		atomic<uint32_t> &c = counts[bucket(ns)];
+		c.store(c.load(memory_order_relaxed) + 1, memory_order_relaxed);
+		n.store(n.load(memory_order_relaxed) + 1, memory_order_relaxed);
+		if (ns > max.load(memory_order_relaxed)) max.store(ns, memory_order_relaxed);
+		return;
+	}
+
+	void add(const Histogram &other)
+	// Add another histogram's counts to this one (used to combine the histograms of several threads)
+	{
+		for (int i = 0; i < HIST_BUCKETS; i++) {
+			counts[i].store(counts[i].load(memory_order_relaxed) + other.counts[i].load(memory_order_relaxed), memory_order_relaxed);
+		}
+		n.store(n.load(memory_order_relaxed) + other.n.load(memory_order_relaxed), memory_order_relaxed);
+		if (other.max.load(memory_order_relaxed) > max.load(memory_order_relaxed)) max.store(other.max.load(memory_order_relaxed), memory_order_relaxed);
+		return;
+	}
+
+	uint64_t percentile(double p) const
+	// Value at or below which p percent of recorded values lie (to within one bucket)
+	{
+		uint64_t total = n.load(memory_order_relaxed);
+		if (total == 0) return 0;
+		uint64_t rank = (uint64_t)(p/100.0*total + 0.5);
+		if (rank < 1) rank = 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < HIST_BUCKETS; i++) {
+			seen += counts[i].load(memory_order_relaxed);
+			if (seen >= rank) {
+				uint64_t value = bucket_value(i);
+				uint64_t largest = max.load(memory_order_relaxed);
+				return value < largest ? value : largest;
+			}
+		}
+		return max.load(memory_order_relaxed);
+	}
+};
+
+
+// Per-stage latency statistics
+// Each Stats has a single writing thread per stage; threads doing the same stage (e.g. one per camera) keep their own
+// Stats, combined with add() for reporting
+struct Stats {
+	Histogram stages[N_STAGES];
+	atomic<uint64_t> counts[N_COUNTS];
+
+	Stats() {
+		for (int i = 0; i < N_COUNTS; i++) counts[i] = 0;
+	}
+
+	void record(int stage, double tick_start, double tick_end)
+	// Record the time between two cv::getTickCount() readings against a stage
+	{
+		double ns = (tick_end - tick_start)*1e9/cv::getTickFrequency();
+		stages[stage].record(ns > 0 ? (uint64_t)ns : 0);
+		return;
+	}
+
+	void count(int counter)
+	// Count one event (single writer per counter)
+	{
+		counts[counter].store(counts[counter].load(memory_order_relaxed) + 1, memory_order_relaxed);
+		return;
+	}
+
+	void add(const Stats &other)
+	// Add another thread's statistics to these
+	{
+		for (int i = 0; i < N_STAGES; i++) stages[i].add(other.stages[i]);
+		for (int i = 0; i < N_COUNTS; i++) {
+			counts[i].store(counts[i].load(memory_order_relaxed) + other.counts[i].load(memory_order_relaxed), memory_order_relaxed);
+		}
+		return;
+	}
+
+	void print(FILE *out) const
+	// Write one line per stage: count, p50, p99 and max in milliseconds, then the publishing decisions
+	{
+		for (int i = 0; i < N_STAGES; i++) {
+			if (stages[i].n == 0) continue;
+			fprintf(out, "%-9s n=%-7llu p50=%8.3f ms  p99=%8.3f ms  max=%8.3f ms\n", STAGE_NAMES[i],
+				(unsigned long long)stages[i].n.load(), stages[i].percentile(50)/1e6, stages[i].percentile(99)/1e6,
+				stages[i].max.load()/1e6);
+		}
+		uint64_t n_decisions = 0;
+		for (int i = 0; i < N_COUNTS; i++) n_decisions += counts[i].load();
+		if (n_decisions == 0) return;
+		fprintf(out, "messages ");
+		for (int i = 0; i < N_COUNTS; i++) fprintf(out, " %s=%llu", COUNT_NAMES[i], (unsigned long long)counts[i].load());
+		fprintf(out, "\n");
+		return;
+	}
+
+	bool save(const char *filename) const
+	// Write the current statistics to a file (replacing its contents)
+	{
+		FILE *f = fopen(filename, "w");
+		if (f == NULL) return false;
+		print(f);
+		fclose(f);
+		return true;
+	}
+};
+
+
+// Statistics requests (kill -USR1 <pid> writes stats.txt)
+volatile sig_atomic_t stats_requested = 0;
+
+void on_stats_signal(int sig)
+// Signal handler, the publishing stage checks stats_requested once per frame
+{
+	stats_requested = 1;
+	return;
+}
+
+
+
+#endif
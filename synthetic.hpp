@@ -0,0 +1,145 @@
+// Header include guard
+#ifndef SYNTHETIC_H	// if synthetic.h has not been included, include it, otherwise do not
+#define SYNTHETIC_H	// see end of file for corresponding #endif
+
+// General includes
+#include <vector>		// vector
+#include <math.h>		// sin, cos, sqrt
+
+// OpenCV includes
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "common.hpp"	// Car
+
+// Namespaces
+using namespace std;
+using namespace cv;
+
+// Synthetic scene definitions:
+#define SCENE_FPS			30		// frame rate of generated sequences
+#define SCENE_BORDER_HUE	15		// hue of the arena's wooden border
+#define SCENE_OMEGA			1.0f	// angular speed of every car around its loop (rad/s)
+#define SCENE_FLICKER		0.5f	// frequency of the lighting variation (Hz)
+
+
+// Ground truth for one car at one time (pixels and pixels/s)
+struct SceneTruth {
+	float x, y;
+	float v_x, v_y;
+};
+
+
+// One car of a synthetic scene: a rectangle of its hue driven around an ellipse at constant angular speed
+struct SceneCar {
+	int hue, delta;				// hue drawn (with per-pixel jitter of up to delta/2)
+	Size size;					// rectangle (pixels)
+	float radius_x, radius_y;	// loop radii (pixels)
+	float phase;				// angle around the loop at time 0 (rad)
+};
+
+
+// Synthetic arena with known ground truth
+// A low-saturation table texture inside a saturated wooden border, with one car-sized rectangle for each car moving
+// around its own loop (cars are spread around the loops so they do not overlap). Each frame adds pixel noise and a
+// lighting change (a brightness gradient across the table that drifts over time), so the detector is tested away
+// from perfect conditions while positions and velocities are known exactly.
+struct SyntheticScene {
+	Size size;					// frame size (pixels)
+	int border;					// border width (pixels), the detector's crop
+	int noise;					// largest per-pixel change of saturation and value
+	float lighting;				// relative brightness change across the table and over time
+	Point2f centre;				// centre of every loop
+	vector<SceneCar> cars;
+	Mat texture;				// table texture (HSV), fixed for the scene
+	Mat hsv;					// frame being rendered (HSV)
+	RNG rng;
+
+	SyntheticScene() : border(0), noise(0), lighting(0), rng(1) {}
+
+	void open_scene(const vector<Car> &cars_all, Size frame_size, int border_px, int pixel_noise, float lighting_change)
+	// Lay out a car for each of cars_all, sized at the middle of its size range, each on a loop of its own
+	{
+		size = frame_size;
+		border = border_px;
+		noise = pixel_noise;
+		lighting = lighting_change;
+		centre = Point2f(size.width/2.0f, size.height/2.0f);
+		texture = Mat(size.height, size.width, CV_8UC3);
+		for (int y = 0; y < size.height; y++) {
+			for (int x = 0; x < size.width; x++) {
+				Vec3b &px = texture.at<Vec3b>(y, x);
+				px[0] = rng.uniform(0, 180);
+				px[1] = rng.uniform(0, 40);
+				px[2] = rng.uniform(90, 170);
+			}
+		}
+		hsv = Mat(size.height, size.width, CV_8UC3);
+
+		int n = cars_all.size();
+		cars.resize(n);
+		for (int i = 0; i < n; i++) {
+			SceneCar &car = cars[i];
+			car.hue = cars_all[i].hue;
+			car.delta = cars_all[i].delta;
+			int area = (cars_all[i].size_min + cars_all[i].size_max)/2;
+			car.size = Size(sqrt(area*1.25f), sqrt(area/1.25f));
+			float fraction = 0.35f + 0.5f*(i + 1)/(n + 1);
+			car.radius_x = fraction*(size.width/2.0f - border - car.size.width);	// loops stay inside the border
+			car.radius_y = fraction*(size.height/2.0f - border - car.size.width);
+			car.phase = 2*M_PI*i/max(n, 1);
+		}
+		return;
+	}
+
+	SceneTruth truth(int i, double t) const
+	// Position and velocity of car i at time t (s)
+	{
+		const SceneCar &car = cars[i];
+		float angle = car.phase + SCENE_OMEGA*t;
+		SceneTruth s;
+		s.x = centre.x + car.radius_x*cos(angle);
+		s.y = centre.y + car.radius_y*sin(angle);
+		s.v_x = -car.radius_x*SCENE_OMEGA*sin(angle);
+		s.v_y = car.radius_y*SCENE_OMEGA*cos(angle);
+		return s;
+	}
+
+	void render(double t, Mat &bgr)
+	// Draw the scene at time t (s) into a BGR frame
+	{
+		float drift = lighting*sin(2*M_PI*SCENE_FLICKER*t);
+		for (int y = 0; y < size.height; y++) {
+			const Vec3b *tex = texture.ptr<Vec3b>(y);
+			Vec3b *out = hsv.ptr<Vec3b>(y);
+			for (int x = 0; x < size.width; x++) {
+				bool edge = x < border || y < border || x >= size.width - border || y >= size.height - border;
+				float gain = 1 + drift + lighting*(float(x)/size.width - 0.5f);
+				int s = edge ? 170 : tex[x][1];
+				int v = edge ? 120 : tex[x][2];
+				out[x][0] = edge ? SCENE_BORDER_HUE : tex[x][0];
+				out[x][1] = saturate_cast<uchar>(s + rng.uniform(-noise, noise + 1));
+				out[x][2] = saturate_cast<uchar>(v*gain + rng.uniform(-noise, noise + 1));
+			}
+		}
+		for (int i = 0; i < cars.size(); i++) {
+			const SceneCar &car = cars[i];
+			SceneTruth s = truth(i, t);
+			int x0 = cvRound(s.x - (car.size.width - 1)/2.0f), y0 = cvRound(s.y - (car.size.height - 1)/2.0f);	// centred on s
+			for (int y = y0; y < y0 + car.size.height; y++) {
+				Vec3b *out = hsv.ptr<Vec3b>(y);
+				for (int x = x0; x < x0 + car.size.width; x++) {
+					float gain = 1 + drift + lighting*(float(x)/size.width - 0.5f);
+					out[x][0] = (car.hue + rng.uniform(-car.delta/2, car.delta/2 + 1) + 180) % 180;
+					out[x][1] = rng.uniform(150, 256);
+					out[x][2] = saturate_cast<uchar>(rng.uniform(160, 230)*gain);
+				}
+			}
+		}
+		cvtColor(hsv, bgr, COLOR_HSV2BGR);
+		return;
+	}
+};
+
+
+
+#endif